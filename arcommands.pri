@@ -0,0 +1,24 @@
+# Generates typed C++ command structs and static command tables from the
+# libARCommands XML at build time. Enable with CONFIG += arsdk_codegen.
+
+arsdk_codegen {
+    isEmpty(ARCOMMANDSGEN_PYTHON): ARCOMMANDSGEN_PYTHON = python
+
+    ARCOMMANDS_XML = \
+        $$PWD/ARSDK/packages/libARCommands/Xml/ARDrone3_commands.xml \
+        $$PWD/ARSDK/packages/libARCommands/Xml/common_commands.xml \
+        $$PWD/ARSDK/packages/libARCommands/Xml/common_debug.xml \
+        $$PWD/ARSDK/packages/libARCommands/Xml/JumpingSumo_commands.xml \
+        $$PWD/ARSDK/packages/libARCommands/Xml/MiniDrone_commands.xml \
+        $$PWD/ARSDK/packages/libARCommands/Xml/SkyController_commands.xml
+
+    arcommandsgen.input = ARCOMMANDS_XML
+    arcommandsgen.output = $$OUT_PWD/arcommands/arcommands_${QMAKE_FILE_BASE}.h
+    arcommandsgen.commands = $$ARCOMMANDSGEN_PYTHON $$PWD/tools/arcommandsgen.py ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+    arcommandsgen.depends = $$PWD/tools/arcommandsgen.py
+    arcommandsgen.CONFIG += no_link target_predeps
+    QMAKE_EXTRA_COMPILERS += arcommandsgen
+
+    INCLUDEPATH += $$PWD/src $$OUT_PWD/arcommands
+    DEFINES += ARSDK_GENERATED_COMMANDS
+}
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = bench_arcommandcodec
+
+QT += testlib
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+include(../../qt-arsdk.pri)
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    bench_arcommandcodec.cpp
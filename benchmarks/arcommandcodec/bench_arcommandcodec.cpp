@@ -0,0 +1,378 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include "arcommandcodec.h"
+#include "arcommanddictionary.h"
+
+#include <QtTest>
+
+#include <QAtomicInt>
+#include <QDir>
+
+#include <cstdlib>
+#include <new>
+
+// Global allocation counter, used to report heap allocations per operation.
+static QAtomicInt allocations;
+
+void* operator new(std::size_t size)
+{
+    allocations.ref();
+    void *p = std::malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+#define XML_PATH ":/ARSDK/packages/libARCommands/Xml"
+#define ALLOCATION_SAMPLES 1000
+
+Q_DECLARE_METATYPE(ARCommandInfo*)
+
+// Representative value for an argument, for building payloads.
+static QVariant sampleValue(const ARCommandArgumentInfo *argument)
+{
+    switch(argument->type)
+    {
+    case ARCommandArgumentInfo::U8:     return QVariant(uint(0xab));
+    case ARCommandArgumentInfo::I8:     return QVariant(int(-100));
+    case ARCommandArgumentInfo::U16:    return QVariant(uint(0xabcd));
+    case ARCommandArgumentInfo::I16:    return QVariant(int(-30000));
+    case ARCommandArgumentInfo::U32:    return QVariant(uint(0xabcdef01));
+    case ARCommandArgumentInfo::I32:    return QVariant(int(-2000000000));
+    case ARCommandArgumentInfo::U64:    return QVariant(qulonglong(0xabcdef0123456789ull));
+    case ARCommandArgumentInfo::I64:    return QVariant(qlonglong(-0x0bcdef0123456789ll));
+    case ARCommandArgumentInfo::Float:  return QVariant(1.5f);
+    case ARCommandArgumentInfo::Double: return QVariant(-2.25);
+    case ARCommandArgumentInfo::String: return QVariant(QString::fromUtf8("qt-arsdk \xc3\xa9t\xc3\xa9"));
+    case ARCommandArgumentInfo::Enum:   return QVariant(argument->enumeration ? argument->enumeration->count - 1 : 0);
+    default:                            return QVariant();
+    }
+}
+
+static QVariantMap sampleParams(const ARCommandInfo *command)
+{
+    QVariantMap params;
+    for(int i = 0; i < command->arguments.size(); i++)
+    {
+        const ARCommandArgumentInfo *argument = command->arguments.at(i);
+        params.insert(*argument->name, sampleValue(argument));
+    }
+    return params;
+}
+
+class BenchARCommandCodec : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void roundTripTypes_data();
+    void roundTripTypes();
+
+    void encode_data();
+    void encode();
+
+    void encodeFrame_data();
+    void encodeFrame();
+
+    void decode_data();
+    void decode();
+
+    void decodeVariantMap_data();
+    void decodeVariantMap();
+
+private:
+    void commandRows();
+    const QString* testString(const QString &value);
+
+    ARCommandDictionary *dictionary;
+    ARCommandCodec      *codec;
+
+    ARCommandClassInfo   testClass;
+    ARCommandEnumInfo    testEnumeration;
+    QList<ARCommandInfo*> testCommands;
+    QList<QString*>       testStrings;
+};
+
+void BenchARCommandCodec::initTestCase()
+{
+    dictionary = new ARCommandDictionary(this);
+    codec = new ARCommandCodec(this);
+
+    QDir xmlDir(XML_PATH);
+    QStringList files = xmlDir.entryList(QStringList() << "*.xml", QDir::Files);
+    QVERIFY2(!files.isEmpty(), "No command dictionaries found in resources.");
+
+    foreach(const QString &file, files)
+    {
+        QVERIFY2(dictionary->import(xmlDir.filePath(file)), qPrintable(file));
+    }
+
+    testClass.id = 0;
+    testClass.project = 0;
+    testClass.name = testString("Test");
+
+    static const QString *enumNames[3];
+    enumNames[0] = testString("a");
+    enumNames[1] = testString("b");
+    enumNames[2] = testString("c");
+
+    testEnumeration.names = enumNames;
+    testEnumeration.count = 3;
+}
+
+void BenchARCommandCodec::cleanupTestCase()
+{
+    foreach(ARCommandInfo *command, testCommands)
+    {
+        delete [] command->arguments.data;
+        delete command;
+    }
+    testCommands.clear();
+
+    qDeleteAll(testStrings);
+    testStrings.clear();
+}
+
+// Test commands live outside a dictionary, so their strings are kept here.
+const QString* BenchARCommandCodec::testString(const QString &value)
+{
+    testStrings.append(new QString(value));
+    return testStrings.last();
+}
+
+void BenchARCommandCodec::roundTripTypes_data()
+{
+    QTest::addColumn<QString>("type");
+    QTest::addColumn<QVariant>("value");
+
+    QTest::newRow("u8")     << "u8"     << QVariant(uint(0xff));
+    QTest::newRow("i8")     << "i8"     << QVariant(int(-128));
+    QTest::newRow("u16")    << "u16"    << QVariant(uint(0xfedc));
+    QTest::newRow("i16")    << "i16"    << QVariant(int(-32768));
+    QTest::newRow("u32")    << "u32"    << QVariant(uint(0xfedcba98));
+    QTest::newRow("i32")    << "i32"    << QVariant(int(-2147483647));
+    QTest::newRow("u64")    << "u64"    << QVariant(qulonglong(0xfedcba9876543210ull));
+    QTest::newRow("i64")    << "i64"    << QVariant(qlonglong(-0x7edcba9876543210ll));
+    QTest::newRow("float")  << "float"  << QVariant(-3.25f);
+    QTest::newRow("double") << "double" << QVariant(1234.5678);
+    QTest::newRow("string") << "string" << QVariant(QString::fromUtf8("caf\xc3\xa9"));
+    QTest::newRow("empty")  << "string" << QVariant(QString());
+    QTest::newRow("enum")   << "enum"   << QVariant(int(2));
+    QTest::newRow("enumName") << "enum" << QVariant(QString("b"));
+}
+
+void BenchARCommandCodec::roundTripTypes()
+{
+    QFETCH(QString, type);
+    QFETCH(QVariant, value);
+
+    // Surround the argument under test with fixed size fields, so offsets
+    // after a variable length field are exercised too.
+    ARCommandInfo *command = new ARCommandInfo;
+    command->id = testCommands.size();
+    command->name = testString(type);
+    command->klass = &testClass;
+    testCommands.append(command);
+
+    QStringList names = QStringList() << "before" << "value" << "after";
+    QStringList types = QStringList() << "u16" << type << "u32";
+
+    command->arguments.data = new ARCommandArgumentInfo[names.size()];
+    command->arguments.count = names.size();
+
+    for(int i = 0; i < names.size(); i++)
+    {
+        ARCommandArgumentInfo *argument = command->arguments.data + i;
+        argument->name = testString(names.at(i));
+        argument->typeName = testString(types.at(i));
+        argument->type = ARCommandArgumentInfo::typeFromName(types.at(i));
+        argument->size = ARCommandArgumentInfo::typeSize(argument->type);
+        argument->enumeration = &testEnumeration;
+    }
+    command->computeOffsets();
+
+    QVariantMap params;
+    params.insert("before", uint(0x1234));
+    params.insert("value", value);
+    params.insert("after", uint(0xdeadbeef));
+
+    QByteArray payload = codec->encode(command, params);
+    ARDecodedCommand decoded = codec->decode(command, payload.constData(), payload.size());
+
+    QCOMPARE(decoded.value(0), params.value("before"));
+    QCOMPARE(decoded.value(2), params.value("after"));
+
+    if(type == "string")
+    {
+        QCOMPARE(decoded.value(1).toString(), value.toString());
+    }
+    else if(type == "enum" && value.type() == QVariant::String)
+    {
+        QCOMPARE(decoded.enumName(1), value.toString());
+        QCOMPARE(decoded.value(1).toInt(), testEnumeration.value(value.toString()));
+    }
+    else
+    {
+        QCOMPARE(decoded.value(1), value);
+    }
+
+    // A truncated payload must not decode the trailing field.
+    ARDecodedCommand truncated = codec->decode(command, payload.constData(), payload.size() - 1);
+    QVERIFY(!truncated.value(2).isValid());
+}
+
+void BenchARCommandCodec::commandRows()
+{
+    QTest::addColumn<ARCommandInfo*>("command");
+
+    foreach(ARCommandInfo *command, dictionary->commands())
+    {
+        QTest::newRow(qPrintable(QString("%1/%2/%3")
+                                 .arg(command->klass->project)
+                                 .arg(*command->klass->name)
+                                 .arg(*command->name)))
+                << command;
+    }
+}
+
+void BenchARCommandCodec::encode_data()
+{
+    commandRows();
+}
+
+void BenchARCommandCodec::encode()
+{
+    QFETCH(ARCommandInfo*, command);
+    QVariantMap params = sampleParams(command);
+
+    int before = allocations.load();
+    for(int i = 0; i < ALLOCATION_SAMPLES; i++) codec->encode(command, params);
+    qDebug("allocations/op: %.2f", qreal(allocations.load() - before) / ALLOCATION_SAMPLES);
+
+    QBENCHMARK {
+        codec->encode(command, params);
+    }
+}
+
+void BenchARCommandCodec::encodeFrame_data()
+{
+    commandRows();
+}
+
+void BenchARCommandCodec::encodeFrame()
+{
+    QFETCH(ARCommandInfo*, command);
+    QVariantMap params = sampleParams(command);
+
+    QByteArray buffer;
+    buffer.reserve(4096);
+
+    int before = allocations.load();
+    for(int i = 0; i < ALLOCATION_SAMPLES; i++)
+    {
+        buffer.resize(0);
+        codec->encodeFrame(buffer, 0x02, 0x00, command, params);
+    }
+    qDebug("allocations/op: %.2f", qreal(allocations.load() - before) / ALLOCATION_SAMPLES);
+
+    QBENCHMARK {
+        buffer.resize(0);
+        codec->encodeFrame(buffer, 0x02, 0x00, command, params);
+    }
+}
+
+void BenchARCommandCodec::decode_data()
+{
+    commandRows();
+}
+
+void BenchARCommandCodec::decode()
+{
+    QFETCH(ARCommandInfo*, command);
+    QVariantMap params = sampleParams(command);
+    QByteArray payload = codec->encode(command, params);
+
+    // Round trip every command in the dictionaries.
+    ARDecodedCommand decoded = codec->decode(command, payload.constData(), payload.size());
+    QCOMPARE(decoded.count(), command->arguments.size());
+    for(int i = 0; i < decoded.count(); i++)
+    {
+        const ARCommandArgumentInfo *argument = command->arguments.at(i);
+        QCOMPARE(decoded.value(i).toString(), params.value(*argument->name).toString());
+    }
+
+    // Touch every field once, the way a listener reading all fields would.
+    int before = allocations.load();
+    for(int i = 0; i < ALLOCATION_SAMPLES; i++)
+    {
+        ARDecodedCommand d = codec->decode(command, payload.constData(), payload.size());
+        for(int j = 0; j < d.count(); j++) d.toDouble(j);
+    }
+    qDebug("allocations/op: %.2f", qreal(allocations.load() - before) / ALLOCATION_SAMPLES);
+
+    QBENCHMARK {
+        ARDecodedCommand d = codec->decode(command, payload.constData(), payload.size());
+        for(int j = 0; j < d.count(); j++) d.toDouble(j);
+    }
+}
+
+void BenchARCommandCodec::decodeVariantMap_data()
+{
+    commandRows();
+}
+
+void BenchARCommandCodec::decodeVariantMap()
+{
+    QFETCH(ARCommandInfo*, command);
+    QByteArray payload = codec->encode(command, sampleParams(command));
+
+    int before = allocations.load();
+    for(int i = 0; i < ALLOCATION_SAMPLES; i++)
+    {
+        codec->decode(command, payload.constData(), payload.size()).toVariantMap();
+    }
+    qDebug("allocations/op: %.2f", qreal(allocations.load() - before) / ALLOCATION_SAMPLES);
+
+    QBENCHMARK {
+        codec->decode(command, payload.constData(), payload.size()).toVariantMap();
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchARCommandCodec)
+
+#include "bench_arcommandcodec.moc"
@@ -1,4 +1,4 @@
-QT += qml quick
+QT += qml quick concurrent
 CONFIG += qt c++11
 
 android {
@@ -15,22 +15,43 @@ HEADERS += \
     $$PWD/src/config.h \
     $$PWD/src/ardiscoverydevice.h \
     $$PWD/src/arnetdiscovery.h \
+    $$PWD/src/arcommandbatch.h \
     $$PWD/src/arcommandcodec.h \
     $$PWD/src/arcommanddictionary.h \
+    $$PWD/src/arcommandtable.h \
     $$PWD/src/arcommandlistener.h \
     $$PWD/src/arcontrolconnection.h \
     $$PWD/src/arcontroller.h \
+    $$PWD/src/arnetworktransport.h \
+    $$PWD/src/arpiloting.h \
+    $$PWD/src/arpreparedcommand.h \
+    $$PWD/src/arspscqueue.h \
     $$PWD/src/arsdk_plugin.h
 
 SOURCES += \
     $$PWD/src/ardiscoverydevice.cpp \
     $$PWD/src/arnetdiscovery.cpp \
+    $$PWD/src/arcommandbatch.cpp \
     $$PWD/src/arcommandcodec.cpp \
     $$PWD/src/arcommanddictionary.cpp \
     $$PWD/src/arcommandlistener.cpp \
     $$PWD/src/arcontrolconnection.cpp \
     $$PWD/src/arcontroller.cpp \
+    $$PWD/src/arnetworktransport.cpp \
+    $$PWD/src/arpiloting.cpp \
+    $$PWD/src/arpreparedcommand.cpp \
     $$PWD/src/arsdk_plugin.cpp
 
+# Linux only: read and write the device sockets in batches with recvmmsg()
+# and sendmmsg() rather than through QUdpSocket. Enable with
+# CONFIG += arsdk_native_udp.
+linux:arsdk_native_udp {
+    HEADERS += $$PWD/src/arnativeudpsocket.h
+    SOURCES += $$PWD/src/arnativeudpsocket.cpp
+    DEFINES += ARSDK_NATIVE_UDP
+}
+
 RESOURCES += \
     $$PWD/arsdk.qrc
+
+include($$PWD/arcommands.pri)
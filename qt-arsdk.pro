@@ -1,6 +1,6 @@
 TEMPLATE = lib
 
-QT += qml quick
+QT += qml quick concurrent
 CONFIG += qt plugin c++11
 
 TARGET = qt-arsdk
@@ -14,23 +14,42 @@ uri = arsdk
 HEADERS += \
     src/common.h \
     src/config.h \
+    src/arcommandbatch.h \
     src/arcommandcodec.h \
     src/arcommanddictionary.h \
+    src/arcommandtable.h \
     src/arcommandlistener.h \
     src/arconnector.h \
     src/arcontroller.h \
+    src/arnetworktransport.h \
+    src/arpiloting.h \
+    src/arpreparedcommand.h \
+    src/arspscqueue.h \
     src/ardevice.h \
     src/arsdk_plugin.h
 
 SOURCES += \
+    src/arcommandbatch.cpp \
     src/arcommandcodec.cpp \
     src/arcommanddictionary.cpp \
     src/arcommandlistener.cpp \
     src/arconnector.cpp \
     src/arcontroller.cpp \
+    src/arnetworktransport.cpp \
+    src/arpiloting.cpp \
+    src/arpreparedcommand.cpp \
     src/ardevice.cpp \
     src/arsdk_plugin.cpp
 
+# Linux only: read and write the device sockets in batches with recvmmsg()
+# and sendmmsg() rather than through QUdpSocket. Enable with
+# CONFIG += arsdk_native_udp.
+linux:arsdk_native_udp {
+    HEADERS += src/arnativeudpsocket.h
+    SOURCES += src/arnativeudpsocket.cpp
+    DEFINES += ARSDK_NATIVE_UDP
+}
+
 !equals(_PRO_FILE_PWD_, $$OUT_PWD) {
     copy_qmldir.target = $$OUT_PWD/qmldir
     copy_qmldir.depends = $$_PRO_FILE_PWD_/qmldir
@@ -48,3 +67,5 @@ unix {
 }
 
 DISTFILES = qmldir
+
+include(arcommands.pri)
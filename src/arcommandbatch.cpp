@@ -0,0 +1,85 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include "arcommandbatch.h"
+
+#include "arcommandcodec.h"
+#include "arcommanddictionary.h"
+
+ARCommandBatch::ARCommandBatch()
+    : m_rows(0)
+{/*...*/}
+
+void ARCommandBatch::append(const ARDecodedCommand &decoded, qint64 timestamp)
+{
+    const ARCommandInfo *command = decoded.command();
+
+    int index = m_index.value(command, -1);
+    if(index < 0)
+    {
+        index = m_groups.size();
+        m_groups.append(ARCommandColumns());
+        m_groups[index].command = command;
+        m_groups[index].columns.resize(command->arguments.size());
+        m_index.insert(command, index);
+    }
+
+    ARCommandColumns &group = m_groups[index];
+    int row = group.rows;
+
+    // Grow storage geometrically, it is never shrunk.
+    if(row >= group.timestamps.size())
+    {
+        int capacity = qMax(16, group.timestamps.size() * 2);
+
+        group.timestamps.resize(capacity);
+        for(int i = 0; i < group.columns.size(); i++)
+        {
+            if(command->arguments.at(i)->type != ARCommandArgumentInfo::String)
+                group.columns[i].resize(capacity);
+        }
+    }
+
+    group.timestamps[row] = timestamp;
+    for(int i = 0; i < group.columns.size(); i++)
+    {
+        if(command->arguments.at(i)->type != ARCommandArgumentInfo::String)
+            group.columns[i][row] = decoded.toDouble(i);
+    }
+
+    group.rows++;
+    m_rows++;
+}
+
+void ARCommandBatch::clear()
+{
+    for(int i = 0; i < m_groups.size(); i++)
+    {
+        m_groups[i].rows = 0;
+    }
+
+    m_rows = 0;
+}
+
+const ARCommandColumns* ARCommandBatch::find(const ARCommandInfo *command) const
+{
+    int index = m_index.value(command, -1);
+    return index < 0 ? NULL : &m_groups.at(index);
+}
@@ -0,0 +1,72 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARCOMMANDBATCH_H
+#define ARCOMMANDBATCH_H
+
+#include <QHash>
+#include <QVector>
+
+class ARCommandInfo;
+class ARDecodedCommand;
+
+// Decoded samples of one command, stored column-wise. Every numeric argument
+// gets a column of doubles (64-bit integers beyond 2^53 lose precision),
+// string arguments are left empty. Only the first rows() entries of each
+// column are valid, storage is kept between batches.
+struct ARCommandColumns
+{
+    ARCommandColumns()
+        : command(NULL), rows(0)
+    {/*...*/}
+
+    const ARCommandInfo *command;
+
+    int rows;
+
+    QVector<qint64>          timestamps; // Nanoseconds since the connection was established.
+    QVector<QVector<double> > columns;   // Indexed by argument.
+};
+
+// Structure-of-arrays batch of decoded commands, grouped by command.
+class ARCommandBatch
+{
+public:
+    ARCommandBatch();
+
+    void append(const ARDecodedCommand &command, qint64 timestamp);
+
+    // Resets row counts, keeping all allocated storage for reuse.
+    void clear();
+
+    bool isEmpty() const { return m_rows == 0; }
+    int  rows() const { return m_rows; }
+
+    int groupCount() const { return m_groups.size(); }
+    const ARCommandColumns& group(int index) const { return m_groups.at(index); }
+    const ARCommandColumns* find(const ARCommandInfo *command) const;
+
+private:
+    QVector<ARCommandColumns>             m_groups;
+    QHash<const ARCommandInfo*, int>      m_index;
+    int                                   m_rows;
+};
+
+#endif // ARCOMMANDBATCH_H
@@ -22,254 +22,358 @@
 
 #include "common.h"
 #include "arcommanddictionary.h"
+#include "arcommandtable.h"
 
-#include <QtEndian>
-#include <QDataStream>
+#include <cstring>
 
 #ifdef WANT_DEBUG
 static void dumpCommandInvokationInfo(const ARCommandInfo *command, const QVariantMap &params)
 {
     QStringList paramspec;
-    foreach(ARCommandArgumentInfo *argument, command->arguments)
+    for(int i = 0; i < command->arguments.size(); i++)
     {
-        QVariant param = params.value(argument->name);
+        const ARCommandArgumentInfo *argument = command->arguments.at(i);
+        QVariant param = params.value(*argument->name);
         QString value;
 
-        if(argument->type == "u8")
+        if(argument->type == ARCommandArgumentInfo::Enum && argument->enumeration && param.type() != QVariant::String)
         {
-            value = QString::number(param.toUInt());
-        }
-        else if(argument->type == "u16")
-        {
-            value = QString::number(param.toUInt());
-        }
-        else if(argument->type == "u32")
-        {
-            value = QString::number(param.toUInt());
-        }
-        else if(argument->type == "u64")
-        {
-            value = QString::number(param.toULongLong());
-        }
-        else if(argument->type == "i8")
-        {
-            value = QString::number(param.toInt());
-        }
-        else if(argument->type == "i16")
-        {
-            value = QString::number(param.toInt());
-        }
-        else if(argument->type == "i32")
-        {
-            value = QString::number(param.toInt());
-        }
-        else if(argument->type == "i64")
-        {
-            value = QString::number(param.toLongLong());
-        }
-        else if(argument->type == "float")
-        {
-            value = QString::number(param.toFloat());
-        }
-        else if(argument->type == "double")
-        {
-            value = QString::number(param.toDouble());
-        }
-        else if(argument->type == "string")
-        {
-            value = param.toString();
-        }
-        else if(argument->type == "enum")
-        {
-            value = argument->enumeration.value(param.toInt());
+            value = argument->enumeration->name(param.toInt());
         }
         else
         {
-            WARNING_T(QString("Unhandled argument type: %1").arg(argument->type));
+            value = param.toString();
         }
 
-        paramspec.append(QString("%1:%2").arg(argument->name).arg(value));
+        paramspec.append(QString("%1:%2").arg(*argument->name).arg(value));
     }
 
     DEBUG_T(QString("Command: %1 %2 %3(%4)")
             .arg(command->klass->project)
-            .arg(command->klass->name)
-            .arg(command->name)
+            .arg(*command->klass->name)
+            .arg(*command->name)
             .arg(paramspec.join(", ")));
 }
 #endif
 
-ARCommandCodec::ARCommandCodec(QObject *parent)
-    : QObject(parent)
+ARDecodedCommand::ARDecodedCommand()
+    : m_command(NULL), m_data(NULL), m_size(0)
+{/*...*/}
+
+ARDecodedCommand::ARDecodedCommand(const ARCommandInfo *command, const char *data, int size)
+    : m_command(command), m_data(data), m_size(size)
+{/*...*/}
+
+bool ARDecodedCommand::matches(quint8 projectId, quint8 classId, quint16 commandId) const
 {
-    TRACE
+    return m_command && m_command->klass->project == projectId
+                     && m_command->klass->id == classId
+                     && m_command->id == commandId;
 }
 
-ARCommandCodec::~ARCommandCodec()
+int ARDecodedCommand::count() const
 {
-    TRACE
+    return m_command ? m_command->arguments.size() : 0;
 }
 
-QVariantMap ARCommandCodec::decode(ARCommandInfo *command, const char *data) const
+int ARDecodedCommand::indexOf(const QString &name) const
 {
-    uint offset = 0;
-    QVariantMap params;
+    for(int i = 0; i < count(); i++)
+    {
+        if(*m_command->arguments.at(i)->name == name) return i;
+    }
+
+    return -1;
+}
+
+const char* ARDecodedCommand::field(int index) const
+{
+    if(index < 0 || index >= count()) return NULL;
+
+    // Start from the closest precomputed offset, and only walk the variable
+    // length fields between it and the one requested.
+    int i = index;
+    while(m_command->arguments.at(i)->offset < 0) i--;
 
-    foreach(ARCommandArgumentInfo *argument, command->arguments)
+    int offset = m_command->arguments.at(i)->offset;
+    for(; i < index; i++)
     {
-        QVariant value;
+        const ARCommandArgumentInfo *argument = m_command->arguments.at(i);
 
-        if(argument->type == "u8")
-        {
-            int v = static_cast<int>(data[offset]);
-            value.setValue(v);
-            offset += 1;
-        }
-        else if(argument->type == "u16")
-        {
-            quint16 v = static_cast<quint16>(data[offset]);
-            value.setValue(v);
-            offset += 2;
-        }
-        else if(argument->type == "u32")
-        {
-            quint32 v = static_cast<quint32>(data[offset]);
-            value.setValue(v);
-            offset += 4;
-        }
-        else if(argument->type == "u64")
-        {
-            quint64 v = static_cast<quint64>(data[offset]);
-            value.setValue(v);
-            offset += 8;
-        }
-        else if(argument->type == "i8")
-        {
-            qint8 v = static_cast<qint8>(data[offset]);
-            value.setValue(v);
-            offset += 1;
-        }
-        else if(argument->type == "i16")
+        if(argument->size > 0)
         {
-            qint16 v = static_cast<qint16>(data[offset]);
-            value.setValue(v);
-            offset += 2;
+            offset += argument->size;
         }
-        else if(argument->type == "i32")
+        else if(argument->type == ARCommandArgumentInfo::String && offset < m_size)
         {
-            qint32 v = static_cast<qint32>(data[offset]);
-            value.setValue(v);
-            offset += 4;
-        }
-        else if(argument->type == "i64")
-        {
-            qint64 v = static_cast<qint64>(data[offset]);
-            value.setValue(v);
-            offset += 8;
-        }
-        else if(argument->type == "float")
-        {
-            float v = qFromLittleEndian(*((float*)(data + offset)));
-            value.setValue(v);
-            offset += 4;
-        }
-        else if(argument->type == "double")
-        {
-            double v = qFromLittleEndian(*((double*)(data + offset)));
-            value.setValue(v);
-            offset += 8;
-        }
-        else if(argument->type == "string")
-        {
-            QString v(data + offset);
-            value.setValue(v);
-            offset += v.length() + 1;
-        }
-        else if(argument->type == "enum")
-        {
-            qint32 v = qFromLittleEndian(static_cast<qint32>(data[offset]));
-            value.setValue(v);
-            offset += 4;
+            const char *end = static_cast<const char*>(std::memchr(m_data + offset, '\0', m_size - offset));
+            if(!end) return NULL;
+            offset = end - m_data + 1;
         }
         else
         {
-            WARNING_T(QString("Unhandled argument type: %1").arg(argument->type));
+            return NULL;
         }
+    }
+
+    const ARCommandArgumentInfo *argument = m_command->arguments.at(index);
 
-        params.insert(argument->name, value);
+    if(argument->size > 0)
+    {
+        if(offset + argument->size > m_size) return NULL;
+    }
+    else if(argument->type == ARCommandArgumentInfo::String)
+    {
+        if(offset >= m_size || !std::memchr(m_data + offset, '\0', m_size - offset)) return NULL;
+    }
+    else
+    {
+        return NULL;
     }
 
-#ifdef WANT_DEBUG
-    dumpCommandInvokationInfo(command, params);
-#endif
+    return m_data + offset;
+}
 
-    return params;
+QVariant ARDecodedCommand::value(int index) const
+{
+    const char *data = field(index);
+    if(!data) return QVariant();
+
+    switch(m_command->arguments.at(index)->type)
+    {
+    case ARCommandArgumentInfo::U8:
+    case ARCommandArgumentInfo::U16:
+    case ARCommandArgumentInfo::U32:
+        return QVariant(static_cast<uint>(toUInt(index)));
+    case ARCommandArgumentInfo::I8:
+    case ARCommandArgumentInfo::I16:
+    case ARCommandArgumentInfo::I32:
+    case ARCommandArgumentInfo::Enum:
+        return QVariant(static_cast<int>(toInt(index)));
+    case ARCommandArgumentInfo::U64:
+        return QVariant(static_cast<qulonglong>(toUInt(index)));
+    case ARCommandArgumentInfo::I64:
+        return QVariant(static_cast<qlonglong>(toInt(index)));
+    case ARCommandArgumentInfo::Float:
+        return QVariant(arReadLE<float>(data));
+    case ARCommandArgumentInfo::Double:
+        return QVariant(arReadLE<double>(data));
+    case ARCommandArgumentInfo::String:
+        return QVariant(toString(index));
+    default:
+        return QVariant();
+    }
 }
 
-QByteArray ARCommandCodec::encode(ARCommandInfo *command, const QVariantMap &params)
+QVariant ARDecodedCommand::value(const QString &name) const
+{
+    return value(indexOf(name));
+}
+
+qint64 ARDecodedCommand::toInt(int index) const
 {
-    QByteArray  payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::LittleEndian);
+    const char *data = field(index);
+    if(!data) return 0;
 
-    foreach(ARCommandArgumentInfo *argument, command->arguments)
+    switch(m_command->arguments.at(index)->type)
     {
-        QVariant param = params.value(argument->name);
+    case ARCommandArgumentInfo::U8:     return static_cast<quint8>(*data);
+    case ARCommandArgumentInfo::I8:     return static_cast<qint8>(*data);
+    case ARCommandArgumentInfo::U16:    return arReadLE<quint16>(data);
+    case ARCommandArgumentInfo::I16:    return arReadLE<qint16>(data);
+    case ARCommandArgumentInfo::U32:    return arReadLE<quint32>(data);
+    case ARCommandArgumentInfo::I32:
+    case ARCommandArgumentInfo::Enum:   return arReadLE<qint32>(data);
+    case ARCommandArgumentInfo::U64:    return static_cast<qint64>(arReadLE<quint64>(data));
+    case ARCommandArgumentInfo::I64:    return arReadLE<qint64>(data);
+    case ARCommandArgumentInfo::Float:  return static_cast<qint64>(arReadLE<float>(data));
+    case ARCommandArgumentInfo::Double: return static_cast<qint64>(arReadLE<double>(data));
+    default:                            return 0;
+    }
+}
 
-        if(argument->type == "u8")
-        {
-            stream << static_cast<quint8>(param.toInt());
-        }
-        else if(argument->type == "u16")
-        {
-            stream << static_cast<quint16>(param.toInt());
-        }
-        else if(argument->type == "u32")
-        {
-            stream << static_cast<quint32>(param.toInt());
-        }
-        else if(argument->type == "u64")
-        {
-            stream << static_cast<quint64>(param.toInt());
-        }
-        else if(argument->type == "i8")
-        {
-            stream << static_cast<qint8>(param.toInt());
-        }
-        else if(argument->type == "i16")
-        {
-            stream << static_cast<qint16>(param.toInt());
-        }
-        else if(argument->type == "i32")
-        {
-            stream << static_cast<qint32>(param.toInt());
-        }
-        else if(argument->type == "i64")
-        {
-            stream << static_cast<qint64>(param.toInt());
-        }
-        else if(argument->type == "float")
-        {
-            stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
-            stream << param.toFloat();
-        }
-        else if(argument->type == "double")
+quint64 ARDecodedCommand::toUInt(int index) const
+{
+    const char *data = field(index);
+    if(!data) return 0;
+
+    if(m_command->arguments.at(index)->type == ARCommandArgumentInfo::U64)
+        return arReadLE<quint64>(data);
+
+    return static_cast<quint64>(toInt(index));
+}
+
+double ARDecodedCommand::toDouble(int index) const
+{
+    const char *data = field(index);
+    if(!data) return 0.0;
+
+    switch(m_command->arguments.at(index)->type)
+    {
+    case ARCommandArgumentInfo::Float:  return arReadLE<float>(data);
+    case ARCommandArgumentInfo::Double: return arReadLE<double>(data);
+    case ARCommandArgumentInfo::U64:    return static_cast<double>(arReadLE<quint64>(data));
+    default:                            return static_cast<double>(toInt(index));
+    }
+}
+
+const char* ARDecodedCommand::toUtf8(int index, int *length) const
+{
+    const char *data = field(index);
+
+    if(!data || m_command->arguments.at(index)->type != ARCommandArgumentInfo::String)
+    {
+        if(length) *length = 0;
+        return NULL;
+    }
+
+    if(length) *length = qstrlen(data);
+    return data;
+}
+
+QString ARDecodedCommand::toString(int index) const
+{
+    int length = 0;
+    const char *data = toUtf8(index, &length);
+    return data ? QString::fromUtf8(data, length) : value(index).toString();
+}
+
+QString ARDecodedCommand::enumName(int index) const
+{
+    const char *data = field(index);
+    if(!data) return QString();
+
+    const ARCommandArgumentInfo *argument = m_command->arguments.at(index);
+    if(argument->type != ARCommandArgumentInfo::Enum || !argument->enumeration) return QString();
+
+    // Shares the interned name, no string is allocated.
+    return argument->enumeration->name(arReadLE<qint32>(data));
+}
+
+QVariantMap ARDecodedCommand::toVariantMap(bool enumNames) const
+{
+    QVariantMap params;
+
+    for(int i = 0; i < count(); i++)
+    {
+        const ARCommandArgumentInfo *argument = m_command->arguments.at(i);
+
+        if(enumNames && argument->type == ARCommandArgumentInfo::Enum && argument->enumeration)
         {
-            stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
-            stream << param.toDouble();
+            params.insert(*argument->name, enumName(i));
         }
-        else if(argument->type == "string")
+        else
         {
-            stream << param.toString().toUtf8().constData();
+            params.insert(*argument->name, value(i));
         }
-        else if(argument->type == "enum")
-        {
-            stream << static_cast<qint32>(param.toInt());
+    }
+
+    return params;
+}
+
+ARCommandCodec::ARCommandCodec(QObject *parent)
+    : QObject(parent)
+{
+    TRACE
+}
+
+ARCommandCodec::~ARCommandCodec()
+{
+    TRACE
+}
+
+ARDecodedCommand ARCommandCodec::decode(ARCommandInfo *command, const char *data, int size) const
+{
+    ARDecodedCommand decoded(command, data, size);
+
+#ifdef WANT_DEBUG
+    dumpCommandInvokationInfo(command, decoded.toVariantMap());
+#endif
+
+    return decoded;
+}
+
+bool ARCommandCodec::writeArgument(char *dst, const ARCommandArgumentInfo *argument, const QVariant &param)
+{
+    switch(argument->type)
+    {
+    case ARCommandArgumentInfo::U8:
+        arWriteLE<quint8>(dst, param.toUInt());
+        return true;
+    case ARCommandArgumentInfo::I8:
+        arWriteLE<qint8>(dst, param.toInt());
+        return true;
+    case ARCommandArgumentInfo::U16:
+        arWriteLE<quint16>(dst, param.toUInt());
+        return true;
+    case ARCommandArgumentInfo::I16:
+        arWriteLE<qint16>(dst, param.toInt());
+        return true;
+    case ARCommandArgumentInfo::U32:
+        arWriteLE<quint32>(dst, param.toUInt());
+        return true;
+    case ARCommandArgumentInfo::I32:
+        arWriteLE<qint32>(dst, param.toInt());
+        return true;
+    case ARCommandArgumentInfo::Enum:
+        // Accept either the value or its symbolic name.
+        if(param.type() == QVariant::String && argument->enumeration)
+        {
+            bool ok = false;
+            qint32 value = argument->enumeration->value(param.toString(), &ok);
+            if(!ok) WARNING_T(QString("Unknown enumeration value: %1").arg(param.toString()));
+            arWriteLE<qint32>(dst, value);
         }
         else
         {
-            WARNING_T(QString("Unhandled argument type: %1").arg(argument->type));
-        }
+            arWriteLE<qint32>(dst, param.toInt());
+        }
+        return true;
+    case ARCommandArgumentInfo::U64:
+        arWriteLE<quint64>(dst, param.toULongLong());
+        return true;
+    case ARCommandArgumentInfo::I64:
+        arWriteLE<qint64>(dst, param.toLongLong());
+        return true;
+    case ARCommandArgumentInfo::Float:
+        arWriteLE<float>(dst, param.toFloat());
+        return true;
+    case ARCommandArgumentInfo::Double:
+        arWriteLE<double>(dst, param.toDouble());
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void appendArgument(QByteArray &payload, const ARCommandArgumentInfo *argument, const QVariant &param)
+{
+    if(argument->size > 0)
+    {
+        int offset = payload.size();
+        payload.resize(offset + argument->size);
+        ARCommandCodec::writeArgument(payload.data() + offset, argument, param);
+    }
+    else if(argument->type == ARCommandArgumentInfo::String)
+    {
+        // Strings are sent null terminated.
+        payload.append(param.toString().toUtf8());
+        payload.append('\0');
+    }
+    else
+    {
+        WARNING_T(QString("Unhandled argument type: %1").arg(*argument->typeName));
+    }
+}
+
+QByteArray ARCommandCodec::encode(ARCommandInfo *command, const QVariantMap &params)
+{
+    QByteArray payload;
+
+    for(int i = 0; i < command->arguments.size(); i++)
+    {
+        const ARCommandArgumentInfo *argument = command->arguments.at(i);
+        appendArgument(payload, argument, params.value(*argument->name));
     }
 
 #ifdef WANT_DEBUG
@@ -278,3 +382,44 @@ QByteArray ARCommandCodec::encode(ARCommandInfo *command, const QVariantMap &par
 
     return payload;
 }
+
+int ARCommandCodec::beginFrame(QByteArray &buffer, quint8 type, quint8 bufferId, quint8 seq)
+{
+    int start = buffer.size();
+
+    buffer.append(static_cast<char>(type));
+    buffer.append(static_cast<char>(bufferId));
+    buffer.append(static_cast<char>(seq));
+    arAppendLE<quint32>(buffer, 0); // Patched by endFrame().
+
+    return start;
+}
+
+quint32 ARCommandCodec::endFrame(QByteArray &buffer, int start)
+{
+    quint32 size = buffer.size() - start;
+    arWriteLE<quint32>(buffer.data() + start + 3, size);
+    return size;
+}
+
+quint32 ARCommandCodec::encodeFrame(QByteArray &buffer, quint8 type, quint8 seq, ARCommandInfo *command, const QVariantMap &params)
+{
+    int start = beginFrame(buffer, type, command->bufferId, seq);
+
+    // Command header.
+    buffer.append(static_cast<char>(command->klass->project));
+    buffer.append(static_cast<char>(command->klass->id));
+    arAppendLE<quint16>(buffer, command->id);
+
+    for(int i = 0; i < command->arguments.size(); i++)
+    {
+        const ARCommandArgumentInfo *argument = command->arguments.at(i);
+        appendArgument(buffer, argument, params.value(*argument->name));
+    }
+
+#ifdef WANT_DEBUG
+    dumpCommandInvokationInfo(command, params);
+#endif
+
+    return endFrame(buffer, start);
+}
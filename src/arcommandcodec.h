@@ -22,8 +22,62 @@
 #define ARCOMMANDCODEC_H
 
 #include <QObject>
+#include <QVariantMap>
+
+#include "config.h"
+#include "arcommandtable.h"
 
 class ARCommandInfo;
+class ARCommandArgumentInfo;
+
+// Non-owning view of a received command, fields are decoded from the payload
+// only when they are read. The view is only valid for as long as the payload
+// it points into.
+class ARDecodedCommand
+{
+public:
+    ARDecodedCommand();
+    ARDecodedCommand(const ARCommandInfo *command, const char *data, int size);
+
+    const ARCommandInfo* command() const { return m_command; }
+    const char* data() const { return m_data; }
+    int size() const { return m_size; }
+
+    bool isValid() const { return m_command != NULL; }
+
+    int count() const;
+    int indexOf(const QString &name) const;
+
+    QVariant value(int index) const;
+    QVariant value(const QString &name) const;
+
+    qint64     toInt(int index) const;
+    quint64    toUInt(int index) const;
+    double     toDouble(int index) const;
+    const char* toUtf8(int index, int *length = 0) const; // Points into the payload.
+    QString    toString(int index) const;
+    QString    enumName(int index) const;
+
+    QVariantMap toVariantMap(bool enumNames = false) const;
+
+    bool matches(quint8 projectId, quint8 classId, quint16 commandId) const;
+
+    // Decodes into a generated command struct (see tools/arcommandsgen.py),
+    // false if this is a different command or the payload is truncated.
+    template<typename C> bool as(C *command) const
+    {
+        if(!matches(C::projectId, C::classId, C::commandId)) return false;
+        return command->decode(m_data, m_size);
+    }
+
+private:
+    const char* field(int index) const;
+
+    const ARCommandInfo *m_command;
+    const char          *m_data;
+    int                  m_size;
+};
+
 class ARCommandCodec : public QObject
 {
     Q_OBJECT
@@ -32,8 +86,48 @@ public:
     explicit ARCommandCodec(QObject *parent = 0);
             ~ARCommandCodec();
 
-    QVariantMap decode(ARCommandInfo *command, const char* payload) const;
-    QByteArray  encode(ARCommandInfo *command, const QVariantMap &params);
+    ARDecodedCommand decode(ARCommandInfo *command, const char* payload, int size) const;
+    QByteArray       encode(ARCommandInfo *command, const QVariantMap &params);
+
+    // Appends a complete frame (frame header, command header and arguments)
+    // to buffer in a single pass, returning the frame size.
+    quint32 encodeFrame(QByteArray &buffer, quint8 type, quint8 seq, ARCommandInfo *command, const QVariantMap &params);
+
+    // Appends a frame header with a placeholder size, returning its offset
+    // in buffer. endFrame() patches the size once the payload is written.
+    static int     beginFrame(QByteArray &buffer, quint8 type, quint8 bufferId, quint8 seq);
+    static quint32 endFrame(QByteArray &buffer, int start);
+
+    // Writes a fixed size argument in place, returns false for variable
+    // length (string) arguments.
+    static bool writeArgument(char *dst, const ARCommandArgumentInfo *argument, const QVariant &param);
+
+    // Appends a frame for a generated command struct, ids and buffer come
+    // from the struct and arguments are written by its encode(). Returns the
+    // frame size or 0 if the command doesn't fit a datagram.
+    template<typename C>
+    static quint32 encodeFrame(QByteArray &buffer, quint8 type, quint8 seq, const C &command)
+    {
+        int start = beginFrame(buffer, type, C::bufferId, seq);
+
+        buffer.append(static_cast<char>(C::projectId));
+        buffer.append(static_cast<char>(C::classId));
+        arAppendLE<quint16>(buffer, C::commandId);
+
+        int offset = buffer.size();
+        int capacity = ARNETWORK_MAX_DATAGRAM_SIZE - (offset - start);
+        buffer.resize(offset + capacity);
+
+        int size = command.encode(buffer.data() + offset, capacity);
+        if(size < 0)
+        {
+            buffer.resize(start);
+            return 0;
+        }
+
+        buffer.resize(offset + size);
+        return endFrame(buffer, start);
+    }
 };
 
 #endif // ARCOMMANDCODEC_H
@@ -19,86 +19,602 @@
 
 */
 #include "arcommanddictionary.h"
+#include "ardiscoverydevice.h"
 
 #include "common.h"
+#include "config.h"
 
+#include <QAtomicPointer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QRegExp>
+#include <QSaveFile>
+#include <QSet>
+#include <QtConcurrent>
+#include <QStandardPaths>
+#include <QWaitCondition>
 #include <QXmlStreamReader>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef ARSDK_GENERATED_COMMANDS
+#include "arcommands_ARDrone3_commands.h"
+#include "arcommands_common_commands.h"
+#include "arcommands_common_debug.h"
+#include "arcommands_JumpingSumo_commands.h"
+#include "arcommands_MiniDrone_commands.h"
+#include "arcommands_SkyController_commands.h"
+#endif
+
+#define ARCOMMANDS_XML_PATH ":/ARSDK/packages/libARCommands/Xml"
+
+#define ARCOMMAND_ARENA_BLOCK_SIZE 16384
+
+// Bump allocator for dictionary metadata. Records are trivially destructible
+// and never freed individually, so teardown frees a handful of blocks and the
+// interned strings.
+class ARCommandArena
+{
+public:
+    ARCommandArena()
+        : m_cursor(NULL), m_remaining(0)
+    {/*...*/}
+
+    ~ARCommandArena()
+    {
+        foreach(const QString *string, m_strings) string->~QString();
+        foreach(char *block, m_blocks) std::free(block);
+    }
+
+    void* allocate(size_t size, size_t alignment)
+    {
+        size_t padding = (alignment - reinterpret_cast<quintptr>(m_cursor) % alignment) % alignment;
+
+        if(padding + size > m_remaining)
+        {
+            size_t blockSize = qMax(size_t(ARCOMMAND_ARENA_BLOCK_SIZE), size + alignment);
+
+            m_cursor = static_cast<char*>(std::malloc(blockSize));
+            Q_CHECK_PTR(m_cursor);
+
+            m_blocks.append(m_cursor);
+            m_remaining = blockSize;
+            padding = (alignment - reinterpret_cast<quintptr>(m_cursor) % alignment) % alignment;
+        }
+
+        char *result = m_cursor + padding;
+        m_cursor = result + size;
+        m_remaining -= padding + size;
+        return result;
+    }
+
+    template<typename T>
+    T* create(int count = 1)
+    {
+        T *records = static_cast<T*>(allocate(sizeof(T) * count, Q_ALIGNOF(T)));
+        for(int i = 0; i < count; i++) new (records + i) T();
+        return records;
+    }
+
+    const QString* intern(const QString &string)
+    {
+        QHash<QString,const QString*>::const_iterator it = m_strings.constFind(string);
+        if(it != m_strings.constEnd()) return it.value();
+
+        const QString *interned = new (allocate(sizeof(QString), Q_ALIGNOF(QString))) QString(string);
+        m_strings.insert(*interned, interned);
+        return interned;
+    }
+
+private:
+    QList<char*> m_blocks;
+    char        *m_cursor;
+    size_t       m_remaining;
+
+    QHash<QString,const QString*> m_strings;
+};
+
+// Binary dictionary cache. One file per source, named and keyed by the SHA-1
+// of the source. Size and modification time are only a pre-check that turns
+// away caches of other sources early, a matching hash is what makes a cache
+// valid. Made of fixed size native-endian records and a string table, so it's
+// memory-mapped and merged straight from the records.
+#define ARCOMMAND_CACHE_MAGIC   0x43445241 // "ARDC"
+#define ARCOMMAND_CACHE_VERSION 4 // 4: Merged in place, no index.
+
+struct ARCommandCacheHeader
+{
+    quint32 magic;
+    quint32 version;
+    qint64  sourceSize;
+    qint64  sourceModified; // Milliseconds since the epoch, 0 if unknown.
+    char    sourceHash[20];
+    quint32 projectId;
+    quint32 stringsOffset;
+    quint32 stringsSize;
+    quint32 classCount;
+    quint32 classesOffset;
+    quint32 commandCount;
+    quint32 commandsOffset;
+    quint32 argumentCount;
+    quint32 argumentsOffset;
+    quint32 enumCount;
+    quint32 enumsOffset;
+};
+
+struct ARCommandCacheClass
+{
+    quint32 id;
+    quint32 name;
+};
+
+struct ARCommandCacheCommand
+{
+    quint32 klass;
+    quint32 id;
+    quint32 name;
+    quint32 bufferId;
+    quint32 firstArgument;
+    quint32 argumentCount;
+};
+
+struct ARCommandCacheArgument
+{
+    quint32 name;
+    quint32 typeName;
+    quint32 firstEnum;
+    quint32 enumCount;
+};
+
+// Validated sections of a mapped cache file.
+struct ARCommandCacheView
+{
+    ARCommandCacheView()
+        : header(NULL), strings(NULL), classes(NULL), commands(NULL), arguments(NULL), enums(NULL)
+    {/*...*/}
+
+    const ARCommandCacheHeader   *header;
+    const char                   *strings;
+    const ARCommandCacheClass    *classes;
+    const ARCommandCacheCommand  *commands;
+    const ARCommandCacheArgument *arguments;
+    const quint32                *enums;
+};
+
+// Definitions as read from a source file, before they're laid out in the
+// arena. Reading touches no dictionary state, so files can be read in parallel.
+struct ARCommandArgumentSource
+{
+    QString     name;
+    QString     typeName;
+    QStringList enumeration;
+};
+
+struct ARCommandClassSource
+{
+    quint8  id;
+    QString name;
+};
+
+struct ARCommandSource
+{
+    int     klass; // Index into ARCommandFileSource::classes.
+    quint16 id;
+    QString name;
+    quint8  bufferId;
+    QVector<ARCommandArgumentSource> arguments;
+};
+
+struct ARCommandFileSource
+{
+    ARCommandFileSource()
+        : ok(false), projectId(0), sourceSize(0), sourceModified(0)
+    {/*...*/}
+
+    QString path;
+
+    bool ok;
+
+    quint8 projectId;
+    qint64     sourceSize;
+    qint64     sourceModified;
+    QByteArray sourceHash;
+
+    // Parsed from the source,
+    QVector<ARCommandClassSource> classes;
+    QVector<ARCommandSource>      commands;
+
+    // or read from its cache, kept mapped until merged.
+    QSharedPointer<QFile> cacheFile;
+    ARCommandCacheView    cache;
+};
+
+static ARCommandFileSource readSource(const QString &path);
+
+// Name index key, (project, class name, command name).
+struct ARCommandNameKey
+{
+    ARCommandNameKey(quint8 p, const QString &k, const QString &c)
+        : project(p), klass(k), command(c)
+    {/*...*/}
+
+    bool operator==(const ARCommandNameKey &other) const
+    {
+        return project == other.project && klass == other.klass && command == other.command;
+    }
+
+    quint8  project;
+    QString klass;
+    QString command;
+};
+
+inline uint qHash(const ARCommandNameKey &key, uint seed = 0)
+{
+    return qHash(key.command, seed) ^ qHash(key.klass, seed) ^ (uint(key.project) << 24);
+}
+
+// A project's lookup indexes. Published tables are never modified, imports
+// publish a new copy, so readers use them without taking the lock.
+struct ARCommandProjectTable
+{
+    QHash<quint32,ARCommandInfo*>          index; // By packed ARCommandInfo::key().
+    QHash<ARCommandNameKey,ARCommandInfo*> names;
+};
+
 struct ARCommandDictionaryPrivate
 {
+    ARCommandDictionaryPrivate()
+        : frozen(false)
+    {/*...*/}
+
+    ~ARCommandDictionaryPrivate()
+    {
+        for(int i = 0; i < 256; i++) delete tables[i].load();
+        qDeleteAll(retiredTables);
+    }
+
+    const ARCommandEnumInfo* internEnumeration(const QStringList &names);
+
+    ARCommandClassInfo* createClass(quint8 project, quint8 id, const QString &name);
+    ARCommandInfo* createCommand(ARCommandClassInfo *klass, quint16 id, const QString &name, quint8 bufferId,
+                                 const QVector<ARCommandArgumentSource> &arguments);
+    ARCommandInfo* createCommand(ARCommandClassInfo *klass, quint16 id, const QString &name, quint8 bufferId,
+                                 int argumentCount);
+    void initArgument(ARCommandArgumentInfo *argument, const QString &name, const QString &typeName,
+                      const ARCommandEnumInfo *enumeration);
+
+    void catalogue();
+
+    bool importFile(const QString &path);
+    bool importTable(const ARCommandTable &table);
+    bool merge(const ARCommandFileSource &source);
+    bool mergeCache(const ARCommandFileSource &source);
+
+    void addClass(ARCommandClassInfo *klass);
+    void addCommand(ARCommandInfo *command);
+
+    // Publishes new tables for projects with commands added since last time.
+    void publish();
+
+    // Backs every class, command, argument, enumeration and string below.
+    ARCommandArena arena;
+
     QList<ARCommandInfo*> commands;
-    QHash<QString,ARCommandClassInfo*> klasses;
+
+    // Classes keyed by (project << 8 | class id), class names are only
+    // unique within a project.
+    QHash<quint16,ARCommandClassInfo*> klasses;
+
+    // Lookup tables by project id. Replaced tables may still be in use by
+    // readers, so they're kept until the dictionary goes away.
+    QAtomicPointer<ARCommandProjectTable> tables[256];
+    QList<ARCommandProjectTable*>         retiredTables;
+    QList<ARCommandInfo*>                 unpublished;
+
+    // Interned enumerations, keyed by their joined value names.
+    QHash<QString,ARCommandEnumInfo*> enumerations;
+
+    // Catalogue of bundled project sources, loaded on demand.
+    QMultiHash<quint8,QString> sources;
+#ifdef ARSDK_GENERATED_COMMANDS
+    QMultiHash<quint8,const ARCommandTable*> generatedTables;
+#endif
+    QHash<QString,quint8> projectIds; // By lower case project name.
+    QSet<quint8> loaded;
+    QSet<quint8> loading;
+
+    // Woken whenever projects finish loading.
+    QWaitCondition projectsLoaded;
+
+    // Guards everything but the published tables, imports take it for
+    // writing so projects can be loaded while other threads decode.
+    mutable QReadWriteLock lock;
+
+    bool frozen;
 };
 
-ARCommandDictionary::ARCommandDictionary(QObject *parent)
-    : QObject(parent), d_ptr(new ARCommandDictionaryPrivate)
+// Files sharing a project id (common and common_debug) are loaded together.
+void ARCommandDictionaryPrivate::catalogue()
 {
-    TRACE
+#ifdef ARSDK_GENERATED_COMMANDS
+    const ARCommandTable *generated[] = {
+        &ARCommands::Tables::ARDrone3_commands(),
+        &ARCommands::Tables::common_commands(),
+        &ARCommands::Tables::common_debug(),
+        &ARCommands::Tables::JumpingSumo_commands(),
+        &ARCommands::Tables::MiniDrone_commands(),
+        &ARCommands::Tables::SkyController_commands()
+    };
+
+    for(size_t i = 0; i < sizeof(generated) / sizeof(generated[0]); i++)
+    {
+        generatedTables.insert(generated[i]->projectId, generated[i]);
+        projectIds.insert(QString::fromLatin1(generated[i]->projectName).toLower(), generated[i]->projectId);
+    }
+#else
+    // Only the root element is read here, the rest is parsed on load.
+    QDir directory(ARCOMMANDS_XML_PATH);
+    foreach(const QString &fileName, directory.entryList(QStringList() << "*.xml", QDir::Files, QDir::Name))
+    {
+        QString path = directory.filePath(fileName);
+
+        QFile file(path);
+        if(!file.open(QIODevice::ReadOnly)) continue;
+
+        QXmlStreamReader xml(&file);
+        if(!xml.readNextStartElement() || xml.name() != "project")
+        {
+            WARNING_T(QString("Skipping %1: Format not understood.").arg(fileName));
+            continue;
+        }
+
+        bool ok = false;
+        quint8 projectId = xml.attributes().value("id").toInt(&ok);
+        if(!ok)
+        {
+            WARNING_T(QString("Skipping %1: No project id specified.").arg(fileName));
+            continue;
+        }
+
+        sources.insert(projectId, path);
+        projectIds.insert(xml.attributes().value("name").toString().toLower(), projectId);
+    }
+#endif
 }
 
-ARCommandDictionary::~ARCommandDictionary()
+const ARCommandEnumInfo* ARCommandDictionaryPrivate::internEnumeration(const QStringList &names)
 {
-    TRACE
-    Q_D(ARCommandDictionary);
+    if(names.isEmpty()) return NULL;
 
-    foreach(ARCommandInfo *command, d->commands)
-        delete command;
+    QString key = names.join(QChar('\n'));
 
-    foreach(ARCommandClassInfo *klass, d->klasses)
-        delete klass;
+    ARCommandEnumInfo *enumeration = enumerations.value(key);
+    if(!enumeration)
+    {
+        enumeration = arena.create<ARCommandEnumInfo>();
+        enumeration->names = arena.create<const QString*>(names.size());
+        enumeration->count = names.size();
 
-    delete d_ptr;
+        for(int i = 0; i < names.size(); i++)
+        {
+            enumeration->names[i] = arena.intern(names.at(i));
+        }
+
+        enumerations.insert(key, enumeration);
+    }
+
+    return enumeration;
 }
 
+void ARCommandDictionaryPrivate::addClass(ARCommandClassInfo *klass)
+{
+    quint16 key = (quint16(klass->project) << 8) | klass->id;
 
-QList<ARCommandInfo*> ARCommandDictionary::commands() const
+    ARCommandClassInfo *existing = klasses.value(key);
+    if(existing && existing != klass)
+    {
+        WARNING_T(QString("Duplicate class definition: %1 %2").arg(klass->project).arg(*klass->name));
+    }
+
+    klasses.insert(key, klass);
+}
+
+void ARCommandDictionaryPrivate::addCommand(ARCommandInfo *command)
 {
-    Q_D(const ARCommandDictionary);
-    return d->commands;
+    command->index = commands.size();
+
+    commands.append(command);
+    unpublished.append(command);
 }
 
-ARCommandInfo* ARCommandDictionary::find(quint8 pId, quint8 cId, quint16 commandId) const
+void ARCommandDictionaryPrivate::publish()
 {
-    Q_D(const ARCommandDictionary);
+    QHash<quint8,ARCommandProjectTable*> updated;
 
-    foreach(ARCommandInfo *command, d->commands)
+    foreach(ARCommandInfo *command, unpublished)
     {
-        if(command->klass->project == pId && command->klass->id == cId && command->id == commandId)
-            return command;
+        quint8 projectId = command->klass->project;
+
+        ARCommandProjectTable *table = updated.value(projectId);
+        if(!table)
+        {
+            ARCommandProjectTable *current = tables[projectId].load();
+            table = current ? new ARCommandProjectTable(*current) : new ARCommandProjectTable;
+            updated.insert(projectId, table);
+        }
+
+        table->index.insert(command->key(), command);
+        table->names.insert(ARCommandNameKey(projectId, *command->klass->name, *command->name), command);
     }
 
-    return NULL;
+    unpublished.clear();
+
+    for(QHash<quint8,ARCommandProjectTable*>::const_iterator it = updated.constBegin(); it != updated.constEnd(); ++it)
+    {
+        ARCommandProjectTable *previous = tables[it.key()].fetchAndStoreOrdered(it.value());
+        if(previous) retiredTables.append(previous);
+    }
 }
 
-ARCommandInfo* ARCommandDictionary::find(quint8 pId, const QString &className, const QString &commandName) const
+const QString& ARCommandEnumInfo::name(int value) const
 {
-    Q_D(const ARCommandDictionary);
+    static const QString unknown;
+    return value >= 0 && value < count ? *names[value] : unknown;
+}
 
-    foreach(ARCommandInfo *command, d->commands)
+// Enumerations are short, a scan beats hashing here.
+int ARCommandEnumInfo::value(const QString &name, bool *ok) const
+{
+    for(int i = 0; i < count; i++)
     {
-        if(command->klass->project == pId && command->klass->name == className && command->name == commandName)
-            return command;
+        if(*names[i] != name) continue;
+
+        if(ok) *ok = true;
+        return i;
     }
 
-    return NULL;
+    if(ok) *ok = false;
+    return -1;
 }
 
-bool ARCommandDictionary::import(const QString &path)
+ARCommandArgumentInfo::Type ARCommandArgumentInfo::typeFromName(const QString &typeName)
 {
-    TRACE
-    Q_D(ARCommandDictionary);
+    if(typeName == "u8") return U8;
+    if(typeName == "i8") return I8;
+    if(typeName == "u16") return U16;
+    if(typeName == "i16") return I16;
+    if(typeName == "u32") return U32;
+    if(typeName == "i32") return I32;
+    if(typeName == "u64") return U64;
+    if(typeName == "i64") return I64;
+    if(typeName == "float") return Float;
+    if(typeName == "double") return Double;
+    if(typeName == "string") return String;
+    if(typeName == "enum") return Enum;
 
-    QFile file(path);
-    QXmlStreamReader xml(&file);
+    return Unknown;
+}
 
-    if(!file.exists())
+quint8 ARCommandArgumentInfo::typeSize(Type type)
+{
+    switch(type)
     {
-        WARNING_T("Failed to import: File not found!");
-        return false;
+    case U8:
+    case I8:
+        return 1;
+    case U16:
+    case I16:
+        return 2;
+    case U32:
+    case I32:
+    case Float:
+    case Enum:
+        return 4;
+    case U64:
+    case I64:
+    case Double:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Resolve argument type once, so the codec doesn't have to.
+static void resolveType(ARCommandArgumentInfo *argument)
+{
+    argument->type = ARCommandArgumentInfo::typeFromName(*argument->typeName);
+    argument->size = ARCommandArgumentInfo::typeSize(argument->type);
+
+    if(argument->type == ARCommandArgumentInfo::Unknown)
+    {
+        WARNING_T(QString("Unhandled argument type: %1").arg(*argument->typeName));
+    }
+}
+
+void ARCommandInfo::computeOffsets()
+{
+    int offset = 0;
+
+    for(int i = 0; i < arguments.count; i++)
+    {
+        ARCommandArgumentInfo *argument = arguments.data + i;
+
+        argument->offset = offset;
+        if(offset >= 0) offset = argument->size > 0 ? offset + argument->size : -1;
+    }
+}
+
+ARCommandClassInfo* ARCommandDictionaryPrivate::createClass(quint8 project, quint8 id, const QString &name)
+{
+    ARCommandClassInfo *klass = arena.create<ARCommandClassInfo>();
+    klass->id = id;
+    klass->project = project;
+    klass->name = arena.intern(name);
+
+    addClass(klass);
+    return klass;
+}
+
+// Arguments are allocated as one array straight after their command, so
+// walking them while decoding touches adjacent memory. They're left for the
+// caller to initialise.
+ARCommandInfo* ARCommandDictionaryPrivate::createCommand(ARCommandClassInfo *klass, quint16 id, const QString &name, quint8 bufferId,
+                                                         int argumentCount)
+{
+    ARCommandInfo *command = arena.create<ARCommandInfo>();
+    command->id = id;
+    command->klass = klass;
+    command->bufferId = bufferId;
+    command->arguments.data = arena.create<ARCommandArgumentInfo>(argumentCount);
+    command->arguments.count = argumentCount;
+    command->name = arena.intern(name);
+    return command;
+}
+
+void ARCommandDictionaryPrivate::initArgument(ARCommandArgumentInfo *argument, const QString &name, const QString &typeName,
+                                              const ARCommandEnumInfo *enumeration)
+{
+    argument->name = arena.intern(name);
+    argument->typeName = arena.intern(typeName);
+    argument->enumeration = enumeration;
+    resolveType(argument);
+}
+
+ARCommandInfo* ARCommandDictionaryPrivate::createCommand(ARCommandClassInfo *klass, quint16 id, const QString &name, quint8 bufferId,
+                                                         const QVector<ARCommandArgumentSource> &arguments)
+{
+    ARCommandInfo *command = createCommand(klass, id, name, bufferId, arguments.size());
+
+    for(int i = 0; i < arguments.size(); i++)
+    {
+        const ARCommandArgumentSource &source = arguments.at(i);
+        initArgument(command->arguments.data + i, source.name, source.typeName, internEnumeration(source.enumeration));
     }
 
-    file.open(QIODevice::ReadOnly);
+    command->computeOffsets();
+    return command;
+}
+
+// Commands are acknowledged unless they say otherwise.
+static quint8 bufferIdFromName(const QString &name)
+{
+    if(name == "NON_ACK") return ARNET_C2D_NONACK_ID;
+    if(name == "HIGH_PRIO") return ARNET_C2D_EMERG_ID;
+    return ARNET_C2D_ACK_ID;
+}
+
+static bool parseXml(const QByteArray &source, ARCommandFileSource *file)
+{
+    QXmlStreamReader xml(source);
 
     if(!xml.readNextStartElement() || xml.name() != "project")
     {
@@ -107,7 +623,7 @@ bool ARCommandDictionary::import(const QString &path)
     }
 
     bool ok = false;
-    quint8 projectId = xml.attributes().value("id").toInt(&ok);
+    file->projectId = xml.attributes().value("id").toInt(&ok);
 
     if(!ok)
     {
@@ -116,9 +632,9 @@ bool ARCommandDictionary::import(const QString &path)
     }
 
     // Currently parsing these objects.
-    ARCommandClassInfo    *klass = NULL;
-    ARCommandInfo         *command = NULL;
-    ARCommandArgumentInfo *argument = NULL;
+    ARCommandClassSource *klass = NULL;
+    ARCommandSource      *command = NULL;
+    bool                  inArgument = false;
 
     // The command Id is reflected by it's position in the Classes definition.
     int commandIndex = 0;
@@ -138,22 +654,22 @@ bool ARCommandDictionary::import(const QString &path)
             {
                 commandIndex = 0; // Reset current commandIndex value.
 
-                klass = new ARCommandClassInfo;
-                klass->id = xml.attributes().value("id").toInt(&ok);
-                klass->name = xml.attributes().value("name").toString();
-                klass->project = projectId;
+                ARCommandClassSource entry;
+                entry.id = xml.attributes().value("id").toInt(&ok);
+                entry.name = xml.attributes().value("name").toString();
 
-                if(!ok || klass->name.isEmpty())
+                if(!ok || entry.name.isEmpty())
                 {
                     WARNING_T("Failed to parse class!");
-                    delete klass;
                     return false;
                 }
+
+                file->classes.append(entry);
+                klass = &file->classes.last();
             }
 
             if(xml.isEndElement())
             {
-                d->klasses.insert(klass->name, klass);
                 klass = NULL;
             }
         }
@@ -167,31 +683,31 @@ bool ARCommandDictionary::import(const QString &path)
                     return false;
                 }
 
-                command = new ARCommandInfo;
-                command->id = commandIndex;
-                command->name = xml.attributes().value("name").toString();
-                command->klass = klass;
-                command->bufferId = xml.attributes().value("buffer").toString() == "NON_ACK" ? 0x0a : 0x0b;
+                ARCommandSource entry;
+                entry.klass = file->classes.size() - 1;
+                entry.id = commandIndex;
+                entry.name = xml.attributes().value("name").toString();
+                entry.bufferId = bufferIdFromName(xml.attributes().value("buffer").toString());
 
-                if(command->name.isEmpty())
+                if(entry.name.isEmpty())
                 {
                     WARNING_T("Failed to parse command!");
-
-                    delete command;
                     return false;
                 }
+
+                file->commands.append(entry);
+                command = &file->commands.last();
             }
 
             if(xml.isEndElement())
             {
-                d->commands.append(command);
                 commandIndex++;
                 command = NULL;
             }
         }
         else if(xml.name() == "arg")
         {
-            if(!argument)
+            if(!inArgument)
             {
                 if(!command)
                 {
@@ -199,30 +715,30 @@ bool ARCommandDictionary::import(const QString &path)
                     return false;
                 }
 
-                argument = new ARCommandArgumentInfo;
-                argument->name = xml.attributes().value("name").toString();
-                argument->type = xml.attributes().value("type").toString();
+                ARCommandArgumentSource argument;
+                argument.name = xml.attributes().value("name").toString();
+                argument.typeName = xml.attributes().value("type").toString();
 
-                if(argument->name.isEmpty() || argument->type.isEmpty())
+                if(argument.name.isEmpty() || argument.typeName.isEmpty())
                 {
                     WARNING_T("Failed to parse argument!");
-                    delete argument;
-                    delete command;
                     return false;
                 }
+
+                command->arguments.append(argument);
+                inArgument = true;
             }
 
             if(xml.isEndElement())
             {
-                command->arguments.append(argument);
-                argument = NULL;
+                inArgument = false;
             }
         }
         else if(xml.name() == "enum")
         {
             if(xml.isEndElement()) continue;
 
-            if(!argument)
+            if(!inArgument)
             {
                 WARNING_T("No current argument instance!");
                 return false;
@@ -235,7 +751,7 @@ bool ARCommandDictionary::import(const QString &path)
                 return false;
             }
 
-            argument->enumeration.append(enumV);
+            command->arguments.last().enumeration.append(enumV);
         }
         else
         {
@@ -246,3 +762,668 @@ bool ARCommandDictionary::import(const QString &path)
 
     return true;
 }
+
+static QString cacheDirectory()
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return location.isEmpty() ? QString() : location + "/arcommands";
+}
+
+static QString cachePath(const QString &source, const QByteArray &sourceHash)
+{
+    QString directory = cacheDirectory();
+    if(directory.isEmpty()) return QString();
+
+    return QString("%1/%2-%3.ardc")
+            .arg(directory)
+            .arg(QFileInfo(source).completeBaseName())
+            .arg(QString(sourceHash.toHex()));
+}
+
+template<typename T>
+static const T* cacheSection(const uchar *data, qint64 size, quint32 offset, quint32 count)
+{
+    if(offset % Q_ALIGNOF(T) || offset > size || quint64(count) * sizeof(T) > quint64(size - offset)) return NULL;
+    return reinterpret_cast<const T*>(data + offset);
+}
+
+// Maps and validates the cache of source, leaving the records in place for
+// mergeCache().
+static bool readCache(const QString &path, ARCommandFileSource *source)
+{
+    QSharedPointer<QFile> file(new QFile(path));
+    if(!file->exists() || !file->open(QIODevice::ReadOnly)) return false;
+
+    qint64 size = file->size();
+    const uchar *data = file->map(0, size);
+    if(!data || size < qint64(sizeof(ARCommandCacheHeader))) return false;
+
+    ARCommandCacheView cache;
+    cache.header = reinterpret_cast<const ARCommandCacheHeader*>(data);
+
+    const ARCommandCacheHeader *header = cache.header;
+
+    if(header->magic != ARCOMMAND_CACHE_MAGIC ||
+       header->version != ARCOMMAND_CACHE_VERSION ||
+       header->sourceSize != source->sourceSize ||
+       header->sourceModified != source->sourceModified ||
+       QByteArray::fromRawData(header->sourceHash, sizeof(header->sourceHash)) != source->sourceHash)
+    {
+        DEBUG_T(QString("Ignoring stale dictionary cache: %1").arg(path));
+        return false;
+    }
+
+    cache.strings   = cacheSection<char>(data, size, header->stringsOffset, header->stringsSize);
+    cache.classes   = cacheSection<ARCommandCacheClass>(data, size, header->classesOffset, header->classCount);
+    cache.commands  = cacheSection<ARCommandCacheCommand>(data, size, header->commandsOffset, header->commandCount);
+    cache.arguments = cacheSection<ARCommandCacheArgument>(data, size, header->argumentsOffset, header->argumentCount);
+    cache.enums     = cacheSection<quint32>(data, size, header->enumsOffset, header->enumCount);
+
+    if(!cache.strings || !cache.classes || !cache.commands || !cache.arguments || !cache.enums ||
+       header->stringsSize == 0 || cache.strings[header->stringsSize - 1] != '\0' || header->projectId > 0xff)
+    {
+        WARNING_T(QString("Ignoring corrupt dictionary cache: %1").arg(path));
+        return false;
+    }
+
+    // Validate every reference, so merging can trust them.
+    for(quint32 i = 0; i < header->classCount; i++)
+    {
+        if(cache.classes[i].name >= header->stringsSize) return false;
+    }
+
+    for(quint32 i = 0; i < header->commandCount; i++)
+    {
+        const ARCommandCacheCommand &c = cache.commands[i];
+        if(c.klass >= header->classCount || c.name >= header->stringsSize ||
+           c.firstArgument > header->argumentCount || c.argumentCount > header->argumentCount - c.firstArgument) return false;
+    }
+
+    for(quint32 i = 0; i < header->argumentCount; i++)
+    {
+        const ARCommandCacheArgument &a = cache.arguments[i];
+        if(a.name >= header->stringsSize || a.typeName >= header->stringsSize ||
+           a.firstEnum > header->enumCount || a.enumCount > header->enumCount - a.firstEnum) return false;
+    }
+
+    for(quint32 i = 0; i < header->enumCount; i++)
+    {
+        if(cache.enums[i] >= header->stringsSize) return false;
+    }
+
+    source->projectId = header->projectId;
+    source->cacheFile = file;
+    source->cache = cache;
+
+    DEBUG_T(QString("Mapped dictionary cache: %1").arg(path));
+    return true;
+}
+
+// Appends a string to the table, sharing identical strings.
+static quint32 cacheString(QByteArray &strings, QHash<QString,quint32> &offsets, const QString &value)
+{
+    QHash<QString,quint32>::const_iterator it = offsets.constFind(value);
+    if(it != offsets.constEnd()) return it.value();
+
+    quint32 offset = strings.size();
+    strings.append(value.toUtf8());
+    strings.append('\0');
+    offsets.insert(value, offset);
+    return offset;
+}
+
+template<typename T>
+static quint32 appendCacheSection(QByteArray &blob, const QVector<T> &records)
+{
+    // Keep every section 8-byte aligned.
+    while(blob.size() % sizeof(quint64)) blob.append('\0');
+
+    quint32 offset = blob.size();
+    if(!records.isEmpty())
+        blob.append(reinterpret_cast<const char*>(records.constData()), records.size() * sizeof(T));
+    return offset;
+}
+
+// Written from the parsed source, so it needs no dictionary state and runs
+// on the thread that read the source.
+static void writeCache(const QString &path, const ARCommandFileSource &source)
+{
+    QByteArray strings;
+    QHash<QString,quint32> stringOffsets;
+
+    QVector<ARCommandCacheClass>    cacheClasses;
+    QVector<ARCommandCacheCommand>  cacheCommands;
+    QVector<ARCommandCacheArgument> cacheArguments;
+    QVector<quint32>                cacheEnums;
+
+    foreach(const ARCommandClassSource &klass, source.classes)
+    {
+        ARCommandCacheClass c;
+        c.id = klass.id;
+        c.name = cacheString(strings, stringOffsets, klass.name);
+        cacheClasses.append(c);
+    }
+
+    foreach(const ARCommandSource &command, source.commands)
+    {
+        ARCommandCacheCommand c;
+        c.klass = command.klass;
+        c.id = command.id;
+        c.name = cacheString(strings, stringOffsets, command.name);
+        c.bufferId = command.bufferId;
+        c.firstArgument = cacheArguments.size();
+        c.argumentCount = command.arguments.size();
+        cacheCommands.append(c);
+
+        foreach(const ARCommandArgumentSource &argument, command.arguments)
+        {
+            ARCommandCacheArgument a;
+            a.name = cacheString(strings, stringOffsets, argument.name);
+            a.typeName = cacheString(strings, stringOffsets, argument.typeName);
+            a.firstEnum = cacheEnums.size();
+            a.enumCount = argument.enumeration.size();
+            cacheArguments.append(a);
+
+            foreach(const QString &value, argument.enumeration)
+            {
+                cacheEnums.append(cacheString(strings, stringOffsets, value));
+            }
+        }
+    }
+
+    ARCommandCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = ARCOMMAND_CACHE_MAGIC;
+    header.version = ARCOMMAND_CACHE_VERSION;
+    header.sourceSize = source.sourceSize;
+    header.sourceModified = source.sourceModified;
+    std::memcpy(header.sourceHash, source.sourceHash.constData(), qMin(source.sourceHash.size(), int(sizeof(header.sourceHash))));
+    header.projectId = source.projectId;
+    header.classCount = cacheClasses.size();
+    header.commandCount = cacheCommands.size();
+    header.argumentCount = cacheArguments.size();
+    header.enumCount = cacheEnums.size();
+    header.stringsSize = strings.size();
+
+    QByteArray blob(sizeof(header), '\0');
+    header.classesOffset = appendCacheSection(blob, cacheClasses);
+    header.commandsOffset = appendCacheSection(blob, cacheCommands);
+    header.argumentsOffset = appendCacheSection(blob, cacheArguments);
+    header.enumsOffset = appendCacheSection(blob, cacheEnums);
+    header.stringsOffset = blob.size();
+    blob.append(strings);
+    std::memcpy(blob.data(), &header, sizeof(header));
+
+    if(!QDir().mkpath(QFileInfo(path).absolutePath())) return;
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly) || file.write(blob) != blob.size() || !file.commit())
+    {
+        WARNING_T(QString("Failed to write dictionary cache: %1").arg(path));
+        return;
+    }
+
+    DEBUG_T(QString("Wrote dictionary cache: %1").arg(path));
+}
+
+ARCommandDictionary::ARCommandDictionary(QObject *parent)
+    : QObject(parent), d_ptr(new ARCommandDictionaryPrivate)
+{
+    TRACE
+}
+
+ARCommandDictionary::~ARCommandDictionary()
+{
+    TRACE
+    delete d_ptr;
+}
+
+
+QSharedPointer<ARCommandDictionary> ARCommandDictionary::shared()
+{
+    static QMutex mutex;
+    static QSharedPointer<ARCommandDictionary> instance;
+
+    QMutexLocker locker(&mutex);
+
+    if(instance.isNull())
+    {
+        DEBUG_T("Cataloguing command dictionary data...");
+        instance = QSharedPointer<ARCommandDictionary>(new ARCommandDictionary);
+        instance->d_func()->catalogue();
+        instance->freeze();
+    }
+
+    return instance;
+}
+
+void ARCommandDictionary::freeze()
+{
+    Q_D(ARCommandDictionary);
+    d->frozen = true;
+}
+
+bool ARCommandDictionary::isFrozen() const
+{
+    Q_D(const ARCommandDictionary);
+    return d->frozen;
+}
+
+QList<ARCommandInfo*> ARCommandDictionary::commands() const
+{
+    Q_D(const ARCommandDictionary);
+    QReadLocker locker(&d->lock);
+    return d->commands;
+}
+
+ARCommandInfo* ARCommandDictionary::find(quint8 pId, quint8 cId, quint16 commandId) const
+{
+    Q_D(const ARCommandDictionary);
+
+    const ARCommandProjectTable *table = d->tables[pId].loadAcquire();
+    return table ? table->index.value(ARCommandInfo::makeKey(pId, cId, commandId)) : NULL;
+}
+
+ARCommandInfo* ARCommandDictionary::find(quint8 pId, const QString &className, const QString &commandName) const
+{
+    Q_D(const ARCommandDictionary);
+
+    const ARCommandProjectTable *table = d->tables[pId].loadAcquire();
+    return table ? table->names.value(ARCommandNameKey(pId, className, commandName)) : NULL;
+}
+
+ARCommandInfo* ARCommandDictionary::resolve(quint8 pId, quint8 cId, quint16 commandId)
+{
+    ARCommandInfo *command = find(pId, cId, commandId);
+
+    if(!command && !isLoaded(pId) && loadProject(pId))
+    {
+        command = find(pId, cId, commandId);
+    }
+
+    return command;
+}
+
+QList<quint8> ARCommandDictionary::projects() const
+{
+    Q_D(const ARCommandDictionary);
+    QReadLocker locker(&d->lock);
+
+    QSet<quint8> projects = d->loaded;
+    foreach(quint8 projectId, d->sources.uniqueKeys()) projects.insert(projectId);
+#ifdef ARSDK_GENERATED_COMMANDS
+    foreach(quint8 projectId, d->generatedTables.uniqueKeys()) projects.insert(projectId);
+#endif
+
+    QList<quint8> result = projects.toList();
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool ARCommandDictionary::isLoaded(quint8 projectId) const
+{
+    Q_D(const ARCommandDictionary);
+    QReadLocker locker(&d->lock);
+    return d->loaded.contains(projectId);
+}
+
+bool ARCommandDictionary::loadProject(quint8 projectId)
+{
+    return loadProjects(QList<quint8>() << projectId);
+}
+
+bool ARCommandDictionary::loadProjects(const QList<quint8> &projectIds)
+{
+    TRACE
+    Q_D(ARCommandDictionary);
+
+    QList<quint8> claimed;
+    QList<quint8> pending;
+    bool result = true;
+
+    // Claim the projects nobody else is loading. Projects claimed elsewhere
+    // are only waited for once ours are done, so two loaders never wait on
+    // each other.
+    {
+        QWriteLocker locker(&d->lock);
+
+        foreach(quint8 projectId, projectIds)
+        {
+            if(d->loaded.contains(projectId) || claimed.contains(projectId)) continue;
+
+            if(d->loading.contains(projectId))
+            {
+                pending.append(projectId);
+            }
+#ifdef ARSDK_GENERATED_COMMANDS
+            else if(d->generatedTables.contains(projectId))
+#else
+            else if(d->sources.contains(projectId))
+#endif
+            {
+                d->loading.insert(projectId);
+                claimed.append(projectId);
+            }
+            else
+            {
+                result = false;
+            }
+        }
+    }
+
+    if(!claimed.isEmpty())
+    {
+#ifndef ARSDK_GENERATED_COMMANDS
+        // Files are read and parsed in parallel without the lock, then merged
+        // in catalogue order so command indexes don't depend on timing.
+        QStringList paths;
+        {
+            QReadLocker locker(&d->lock);
+            foreach(quint8 projectId, claimed)
+            {
+                QStringList projectPaths = d->sources.values(projectId);
+                std::sort(projectPaths.begin(), projectPaths.end());
+                paths.append(projectPaths);
+            }
+        }
+
+        QList<ARCommandFileSource> sources = QtConcurrent::blockingMapped<QList<ARCommandFileSource> >(paths, readSource);
+#endif
+
+        {
+            QWriteLocker locker(&d->lock);
+
+#ifdef ARSDK_GENERATED_COMMANDS
+            foreach(quint8 projectId, claimed)
+            {
+                foreach(const ARCommandTable *table, d->generatedTables.values(projectId)) d->importTable(*table);
+            }
+#else
+            foreach(const ARCommandFileSource &source, sources)
+            {
+                if(!d->merge(source)) result = false;
+            }
+#endif
+
+            d->publish();
+
+            foreach(quint8 projectId, claimed)
+            {
+                DEBUG_T(QString("Loaded command project %1").arg(projectId));
+                d->loading.remove(projectId);
+                d->loaded.insert(projectId);
+            }
+
+            d->projectsLoaded.wakeAll();
+        }
+
+        foreach(quint8 projectId, claimed) emit projectLoaded(projectId);
+    }
+
+    if(!pending.isEmpty())
+    {
+        QWriteLocker locker(&d->lock);
+
+        foreach(quint8 projectId, pending)
+        {
+            while(d->loading.contains(projectId)) d->projectsLoaded.wait(&d->lock);
+        }
+    }
+
+    return result;
+}
+
+QFuture<bool> ARCommandDictionary::loadProjectsAsync(const QList<quint8> &projectIds)
+{
+    return QtConcurrent::run(this, &ARCommandDictionary::loadProjects, projectIds);
+}
+
+QList<quint8> ARCommandDictionary::projectsForDevice(const QJsonObject &parameters) const
+{
+    Q_D(const ARCommandDictionary);
+    QReadLocker locker(&d->lock);
+
+    QList<quint8> projects;
+    projects << ARCOMMANDS_PROJECT_COMMON;
+
+    // A SkyController relays the commands of the drone paired with it.
+    if(parameters.contains(ARDISCOVERY_KEY_SKYCONTROLLER_VERSION))
+    {
+        projects << ARCOMMANDS_PROJECT_SKYCONTROLLER << ARCOMMANDS_PROJECT_ARDRONE3;
+    }
+
+    // Features are either a bitmask of project ids, or a list of project names.
+    QJsonValue features = parameters.value(ARDISCOVERY_KEY_FEATURES);
+    QStringList featureNames;
+
+    if(features.isArray())
+    {
+        foreach(const QJsonValue &feature, features.toArray()) featureNames << feature.toString();
+    }
+    else if(features.isDouble())
+    {
+        featureNames << QString::number(features.toVariant().toULongLong());
+    }
+    else
+    {
+        featureNames = features.toString().split(QRegExp("[\\s,;]+"), QString::SkipEmptyParts);
+    }
+
+    foreach(const QString &feature, featureNames)
+    {
+        bool ok = false;
+        quint64 mask = feature.toULongLong(&ok, 0);
+
+        if(ok && featureNames.size() == 1)
+        {
+            for(int projectId = 0; projectId < 64; projectId++)
+            {
+                if(mask & (Q_UINT64_C(1) << projectId)) projects << quint8(projectId);
+            }
+        }
+        else if(d->projectIds.contains(feature.toLower()))
+        {
+            projects << d->projectIds.value(feature.toLower());
+        }
+    }
+
+    // Nothing more specific to go on, assume the default product.
+    if(projects.size() == 1) projects << ARCOMMANDS_DEFAULT_PROJECT;
+
+    QList<quint8> result;
+    foreach(quint8 projectId, projects)
+    {
+        if(!result.contains(projectId)) result << projectId;
+    }
+
+    return result;
+}
+
+bool ARCommandDictionary::import(const QString &path)
+{
+    TRACE
+    Q_D(ARCommandDictionary);
+
+    QWriteLocker locker(&d->lock);
+
+    if(d->frozen)
+    {
+        WARNING_T("Failed to import: Dictionary is frozen.");
+        return false;
+    }
+
+    bool result = d->importFile(path);
+    d->publish();
+    return result;
+}
+
+bool ARCommandDictionary::import(const ARCommandTable &table)
+{
+    TRACE
+    Q_D(ARCommandDictionary);
+
+    QWriteLocker locker(&d->lock);
+
+    if(d->frozen)
+    {
+        WARNING_T("Failed to import: Dictionary is frozen.");
+        return false;
+    }
+
+    bool result = d->importTable(table);
+    d->publish();
+    return result;
+}
+
+static ARCommandFileSource readSource(const QString &path)
+{
+    ARCommandFileSource source;
+    source.path = path;
+
+    QFileInfo info(path);
+
+    if(!info.exists())
+    {
+        WARNING_T("Failed to import: File not found!");
+        return source;
+    }
+
+    QDateTime modified = info.lastModified();
+    source.sourceSize = info.size();
+    source.sourceModified = modified.isValid() ? modified.toMSecsSinceEpoch() : 0;
+
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        WARNING_T("Failed to import: File not readable!");
+        return source;
+    }
+
+    // Hashing the source costs little next to parsing it, and unlike its
+    // metadata it can't go stale across builds.
+    QByteArray data = file.readAll();
+    source.sourceHash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+
+    // Prefer a binary cache built from this exact source, if there is one.
+    QString cache = cachePath(path, source.sourceHash);
+    if(!cache.isEmpty() && readCache(cache, &source))
+    {
+        source.ok = true;
+        return source;
+    }
+
+    source.ok = parseXml(data, &source);
+    if(source.ok && !cache.isEmpty()) writeCache(cache, source);
+    return source;
+}
+
+bool ARCommandDictionaryPrivate::importFile(const QString &path)
+{
+    return merge(readSource(path));
+}
+
+bool ARCommandDictionaryPrivate::merge(const ARCommandFileSource &source)
+{
+    if(!source.ok) return false;
+    if(source.cache.header) return mergeCache(source);
+
+    QVector<ARCommandClassInfo*> classes(source.classes.size());
+    for(int i = 0; i < source.classes.size(); i++)
+    {
+        classes[i] = createClass(source.projectId, source.classes.at(i).id, source.classes.at(i).name);
+    }
+
+    foreach(const ARCommandSource &command, source.commands)
+    {
+        addCommand(createCommand(classes.at(command.klass), command.id, command.name, command.bufferId, command.arguments));
+    }
+
+    return true;
+}
+
+// Builds records straight from the mapped cache, each string in its table is
+// only converted once.
+bool ARCommandDictionaryPrivate::mergeCache(const ARCommandFileSource &source)
+{
+    const ARCommandCacheView &cache = source.cache;
+    const ARCommandCacheHeader *header = cache.header;
+
+    QHash<quint32,const QString*> strings;
+    strings.reserve(header->stringsSize / 8);
+
+    auto string = [&](quint32 offset) -> const QString& {
+        const QString *&interned = strings[offset];
+        if(!interned) interned = arena.intern(QString::fromUtf8(cache.strings + offset));
+        return *interned;
+    };
+
+    QVector<ARCommandClassInfo*> classes(header->classCount);
+    for(quint32 i = 0; i < header->classCount; i++)
+    {
+        classes[i] = createClass(source.projectId, cache.classes[i].id, string(cache.classes[i].name));
+    }
+
+    QStringList enumeration;
+
+    for(quint32 i = 0; i < header->commandCount; i++)
+    {
+        const ARCommandCacheCommand &c = cache.commands[i];
+
+        ARCommandInfo *command = createCommand(classes.at(c.klass), c.id, string(c.name), c.bufferId, c.argumentCount);
+
+        for(quint32 j = 0; j < c.argumentCount; j++)
+        {
+            const ARCommandCacheArgument &a = cache.arguments[c.firstArgument + j];
+
+            enumeration.clear();
+            for(quint32 k = a.firstEnum; k < a.firstEnum + a.enumCount; k++)
+            {
+                enumeration.append(string(cache.enums[k]));
+            }
+
+            initArgument(command->arguments.data + j, string(a.name), string(a.typeName), internEnumeration(enumeration));
+        }
+
+        command->computeOffsets();
+        addCommand(command);
+    }
+
+    return true;
+}
+
+bool ARCommandDictionaryPrivate::importTable(const ARCommandTable &table)
+{
+    ARCommandClassInfo *klass = NULL;
+    QVector<ARCommandArgumentSource> arguments;
+
+    for(int i = 0; i < table.commandCount; i++)
+    {
+        const ARCommandTableCommand &entry = table.commands[i];
+
+        // Table entries are grouped by class.
+        if(!klass || klass->id != entry.classId)
+        {
+            klass = createClass(table.projectId, entry.classId, QString::fromLatin1(entry.className));
+        }
+
+        arguments.resize(entry.argumentCount);
+        for(int j = 0; j < entry.argumentCount; j++)
+        {
+            const ARCommandTableArgument &arg = entry.arguments[j];
+
+            ARCommandArgumentSource &argument = arguments[j];
+            argument.name = QString::fromLatin1(arg.name);
+            argument.typeName = QString::fromLatin1(arg.type);
+            argument.enumeration.clear();
+
+            for(int k = 0; k < arg.enumerationCount; k++)
+            {
+                argument.enumeration.append(QString::fromLatin1(arg.enumeration[k]));
+            }
+        }
+
+        addCommand(createCommand(klass, entry.commandId, QString::fromLatin1(entry.name), entry.bufferId, arguments));
+    }
+
+    return true;
+}
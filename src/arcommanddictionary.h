@@ -22,40 +22,117 @@
 #define ARCOMMANDDICTIONARY_H
 
 #include <QObject>
+#include <QFuture>
+#include <QJsonObject>
+#include <QSharedPointer>
+#include <QHash>
 #include <QStringList>
+#include <QVector>
+
+struct ARCommandTable;
+
+// Dictionary metadata lives in an arena owned by the dictionary, records are
+// never freed individually. Strings are interned, so every record referring to
+// the same name shares one copy.
 
 struct ARCommandClassInfo
 {
     quint8  id;
     quint8  project;
-    QString name;
+    const QString *name;
+};
+
+// Enumeration values, interned once per dictionary and shared by every
+// argument with the same set of names.
+struct ARCommandEnumInfo
+{
+    const QString& name(int value) const;
+    int value(const QString &name, bool *ok = 0) const;
+
+    const QString **names; // Indexed by value.
+    int             count;
 };
 
 struct ARCommandArgumentInfo
 {
-    QString name;
-    QString type;
+    typedef enum {
+        Unknown = 0,
+        U8,
+        I8,
+        U16,
+        I16,
+        U32,
+        I32,
+        U64,
+        I64,
+        Float,
+        Double,
+        String,
+        Enum
+    } Type;
+
+    ARCommandArgumentInfo()
+        : type(Unknown), size(0), offset(-1), enumeration(NULL), name(NULL), typeName(NULL)
+    {/*...*/}
+
+    static Type   typeFromName(const QString &typeName);
+    static quint8 typeSize(Type type);
 
-    QStringList enumeration; // Used if type == 'enum'.
+    // Decoding only needs these, so they come first.
+    Type   type; // Resolved from typeName at import time.
+    quint8 size; // Encoded size in bytes, 0 if variable length (string).
+
+    // Payload offset, or -1 if it follows a variable length (string) argument
+    // and has to be resolved against the payload.
+    int offset;
+
+    const ARCommandEnumInfo *enumeration; // Used if type == Enum.
+
+    const QString *name;
+    const QString *typeName;
+};
+
+// A command's arguments, stored contiguously right after the command.
+struct ARCommandArgumentList
+{
+    ARCommandArgumentList()
+        : data(NULL), count(0)
+    {/*...*/}
+
+    int  size() const { return count; }
+    bool isEmpty() const { return count == 0; }
+
+    const ARCommandArgumentInfo* at(int i) const { return data + i; }
+
+    ARCommandArgumentInfo *data;
+    int                    count;
 };
 
 struct ARCommandInfo
 {
     ARCommandInfo()
-        : bufferId(0x0d)
+        : name(NULL), index(-1), klass(NULL), bufferId(0x0d)
     {/*...*/}
 
-    ~ARCommandInfo()
+    // Precompute argument offsets up to the first variable length argument.
+    void computeOffsets();
+
+    // Packed (project, class, command) identifier.
+    static quint32 makeKey(quint8 project, quint8 klass, quint16 command)
     {
-        foreach(ARCommandArgumentInfo *a, arguments) delete a;
+        return (quint32(project) << 24) | (quint32(klass) << 16) | command;
     }
 
+    quint32 key() const { return makeKey(klass->project, klass->id, id); }
+
     quint16 id;
-    QString name;
+    const QString *name;
+
+    int index; // Position in the dictionary, for per-command bitmaps.
 
     ARCommandClassInfo *klass;
 
-    QList<ARCommandArgumentInfo*> arguments;
+    ARCommandArgumentList arguments;
 
     quint8 bufferId;
 };
@@ -70,12 +147,50 @@ public:
     explicit ARCommandDictionary(QObject *parent = 0);
             ~ARCommandDictionary();
 
+    // The process-wide dictionary of the bundled command sets, frozen and safe
+    // to share between threads and connections. Projects are catalogued on
+    // first use, but only loaded when asked for with loadProject().
+    static QSharedPointer<ARCommandDictionary> shared();
+
     QList<ARCommandInfo*> commands() const;
 
+    // Lookups don't lock, each project's commands are published as an
+    // immutable table, so they're safe on any thread while projects load.
     ARCommandInfo* find(quint8 pId, quint8 cId, quint16 commandId) const;
     ARCommandInfo* find(quint8 pId, const QString &className, const QString &commandName) const;
 
+    // As find(), but loads the command's project first if it's catalogued and
+    // not loaded yet, or waits for it if it's still loading.
+    ARCommandInfo* resolve(quint8 pId, quint8 cId, quint16 commandId);
+
     bool import(const QString &path);
+    bool import(const ARCommandTable &table);
+
+    // Once frozen no more commands can be imported, and the dictionary is
+    // only ever read. Catalogued projects can still be loaded.
+    void freeze();
+    bool isFrozen() const;
+
+    // Catalogued projects, and those already loaded.
+    QList<quint8> projects() const;
+    bool isLoaded(quint8 projectId) const;
+
+    // Loads catalogued projects, if they aren't already, reading their source
+    // files in parallel. Waits for projects another thread is loading, and
+    // returns false if any project isn't in the catalogue.
+    bool loadProject(quint8 projectId);
+    bool loadProjects(const QList<quint8> &projectIds);
+
+    // As loadProjects(), on the global thread pool.
+    QFuture<bool> loadProjectsAsync(const QList<quint8> &projectIds);
+
+    // The projects a device needs up front, judged from its discovery
+    // parameters. Anything else is loaded when its first frame arrives.
+    QList<quint8> projectsForDevice(const QJsonObject &parameters) const;
+
+Q_SIGNALS:
+    // New commands are available, and may be emitted from any thread.
+    void projectLoaded(quint8 projectId);
 
 private:
     class ARCommandDictionaryPrivate *d_ptr;
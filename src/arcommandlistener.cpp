@@ -19,12 +19,13 @@
 
 */
 #include "arcommandlistener.h"
+#include "arcommanddictionary.h"
 #include "common.h"
 
 struct ARCommandListenerPrivate
 {
     ARCommandListenerPrivate()
-        : projectId(0), className(""), commandName("")
+        : projectId(-1), className(""), commandName(""), enumNames(false), everySample(false)
     {/*...*/}
 
     int listenerId;
@@ -32,6 +33,8 @@ struct ARCommandListenerPrivate
     QString className;
     QString commandName;
     QVariant callback;
+    bool enumNames;
+    bool everySample;
 };
 
 ARCommandListener::ARCommandListener(QObject *parent)
@@ -110,6 +113,17 @@ void ARCommandListener::setCommandName(const QString &commandName)
     }
 }
 
+bool ARCommandListener::matches(const ARCommandInfo &command) const
+{
+    Q_D(const ARCommandListener);
+
+    if(d->commandName != *command.name) return false;
+    if(!d->className.isEmpty() && d->className != *command.klass->name) return false;
+    if(d->projectId >= 0 && d->projectId != command.klass->project) return false;
+
+    return true;
+}
+
 QVariant ARCommandListener::callback() const
 {
     Q_D(const ARCommandListener);
@@ -121,3 +135,35 @@ void ARCommandListener::setCallback(QVariant callback)
     Q_D(ARCommandListener);
     d->callback = callback;
 }
+
+bool ARCommandListener::enumNames() const
+{
+    Q_D(const ARCommandListener);
+    return d->enumNames;
+}
+
+void ARCommandListener::setEnumNames(bool enumNames)
+{
+    Q_D(ARCommandListener);
+    if(d->enumNames != enumNames)
+    {
+        d->enumNames = enumNames;
+        emit enumNamesChanged();
+    }
+}
+
+bool ARCommandListener::everySample() const
+{
+    Q_D(const ARCommandListener);
+    return d->everySample;
+}
+
+void ARCommandListener::setEverySample(bool everySample)
+{
+    Q_D(ARCommandListener);
+    if(d->everySample != everySample)
+    {
+        d->everySample = everySample;
+        emit everySampleChanged();
+    }
+}
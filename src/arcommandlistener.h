@@ -24,6 +24,8 @@
 #include <QObject>
 #include <QVariant>
 
+class ARCommandInfo;
+
 class ARCommandListener : public QObject
 {
     Q_OBJECT
@@ -33,6 +35,8 @@ class ARCommandListener : public QObject
     Q_PROPERTY(QString className READ className WRITE setClassName NOTIFY classNameChanged)
     Q_PROPERTY(QString commandName READ commandName WRITE setCommandName NOTIFY commandNameChanged)
     Q_PROPERTY(QVariant callback READ callback)
+    Q_PROPERTY(bool enumNames READ enumNames WRITE setEnumNames NOTIFY enumNamesChanged)
+    Q_PROPERTY(bool everySample READ everySample WRITE setEverySample NOTIFY everySampleChanged)
 
 public:
     explicit ARCommandListener(QObject *parent = 0);
@@ -53,11 +57,25 @@ public:
     QVariant callback() const;
     void setCallback(QVariant callback);
 
+    // Whether the command matches, an empty className or a negative
+    // projectId match any class or project.
+    bool matches(const ARCommandInfo &command) const;
+
+    // Deliver enumeration arguments by name rather than by value.
+    bool enumNames() const;
+    Q_INVOKABLE void setEnumNames(bool enumNames);
+
+    // Also deliver commands whose payload is identical to the previous one.
+    bool everySample() const;
+    Q_INVOKABLE void setEverySample(bool everySample);
+
 Q_SIGNALS:
     void listenerIdChanged();
     void projectIdChanged();
     void classNameChanged();
     void commandNameChanged();
+    void enumNamesChanged();
+    void everySampleChanged();
 
     void received(const QVariantMap &params);
 
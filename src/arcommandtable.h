@@ -0,0 +1,186 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARCOMMANDTABLE_H
+#define ARCOMMANDTABLE_H
+
+#include <QtEndian>
+#include <QByteArray>
+
+#include <cstring>
+
+// Static command metadata, as emitted by tools/arcommandsgen.py from the
+// libARCommands XML. ARCommandDictionary::import() accepts these in place
+// of the XML files.
+struct ARCommandTableArgument
+{
+    const char         *name;
+    const char         *type;
+    const char * const *enumeration;
+    int                 enumerationCount;
+};
+
+struct ARCommandTableCommand
+{
+    quint8      classId;
+    const char *className;
+    quint16     commandId;
+    const char *name;
+    quint8      bufferId;
+
+    const ARCommandTableArgument *arguments;
+    int                           argumentCount;
+};
+
+struct ARCommandTable
+{
+    quint8      projectId;
+    const char *projectName;
+
+    const ARCommandTableCommand *commands;
+    int                          commandCount;
+};
+
+// Alignment-safe little-endian loads and stores, payload offsets are only
+// byte aligned.
+template<typename T>
+inline T arReadLE(const char *src)
+{
+    return qFromLittleEndian<T>(reinterpret_cast<const uchar*>(src));
+}
+
+template<>
+inline float arReadLE<float>(const char *src)
+{
+    quint32 bits = arReadLE<quint32>(src);
+    float v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+template<>
+inline double arReadLE<double>(const char *src)
+{
+    quint64 bits = arReadLE<quint64>(src);
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+template<typename T>
+inline void arWriteLE(char *dst, T value)
+{
+    qToLittleEndian<T>(value, reinterpret_cast<uchar*>(dst));
+}
+
+template<>
+inline void arWriteLE<float>(char *dst, float value)
+{
+    quint32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    arWriteLE<quint32>(dst, bits);
+}
+
+template<>
+inline void arWriteLE<double>(char *dst, double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    arWriteLE<quint64>(dst, bits);
+}
+
+template<typename T>
+inline void arAppendLE(QByteArray &dst, T value)
+{
+    char buffer[sizeof(T)];
+    arWriteLE<T>(buffer, value);
+    dst.append(buffer, sizeof(T));
+}
+
+// Bounded argument writer used by generated command structs.
+class ARCommandWriter
+{
+public:
+    ARCommandWriter(char *dst, int capacity)
+        : m_dst(dst), m_capacity(capacity), m_size(0)
+    {/*...*/}
+
+    template<typename T>
+    void put(T value)
+    {
+        if(m_size < 0 || m_size + int(sizeof(T)) > m_capacity) { m_size = -1; return; }
+        arWriteLE<T>(m_dst + m_size, value);
+        m_size += sizeof(T);
+    }
+
+    void putString(const char *value)
+    {
+        int length = value ? int(qstrlen(value)) : 0;
+        if(m_size < 0 || m_size + length + 1 > m_capacity) { m_size = -1; return; }
+        if(length > 0) std::memcpy(m_dst + m_size, value, length);
+        m_dst[m_size + length] = '\0';
+        m_size += length + 1;
+    }
+
+    int result() const { return m_size; }
+
+private:
+    char *m_dst;
+    int   m_capacity;
+    int   m_size;
+};
+
+// Bounded argument reader used by generated command structs, strings point
+// into the source payload.
+class ARCommandReader
+{
+public:
+    ARCommandReader(const char *src, int size)
+        : m_src(src), m_size(size), m_offset(0)
+    {/*...*/}
+
+    template<typename T>
+    T get()
+    {
+        if(m_offset < 0 || m_offset + int(sizeof(T)) > m_size) { m_offset = -1; return T(); }
+        T value = arReadLE<T>(m_src + m_offset);
+        m_offset += sizeof(T);
+        return value;
+    }
+
+    const char* getString()
+    {
+        if(m_offset < 0 || m_offset >= m_size) { m_offset = -1; return 0; }
+        const char *value = m_src + m_offset;
+        const void *end = std::memchr(value, '\0', m_size - m_offset);
+        if(!end) { m_offset = -1; return 0; }
+        m_offset = static_cast<const char*>(end) - m_src + 1;
+        return value;
+    }
+
+    bool ok() const { return m_offset >= 0; }
+
+private:
+    const char *m_src;
+    int         m_size;
+    int         m_offset;
+};
+
+#endif // ARCOMMANDTABLE_H
@@ -4,50 +4,88 @@
 #include "arcontrolconnection.h"
 #include "arcontroller.h"
 
+#include "arcommandbatch.h"
 #include "arcommandcodec.h"
 #include "arcommanddictionary.h"
 #include "arcommandlistener.h"
+#include "arpreparedcommand.h"
 
 #include "ardiscoverydevice.h"
+#include "arnetworktransport.h"
+#include "arpiloting.h"
 
+#include <QJSEngine>
+#include <QQmlEngine>
+#include <QThread>
 #include <QtEndian>
-#include <QDataStream>
-#include <QUdpSocket>
+#include <QVarLengthArray>
 
-#include <QJSEngine>
+#include <cstring>
+
+// An entry of sendCommands(), either a prepared command or a resolved one
+// with its arguments.
+struct ARBatchEntry
+{
+    ARPreparedCommand *prepared;
+    ARCommandInfo     *command;
+    QVariantMap        params;
+};
 
 class ARControlConnectionPrivate
 {
 public:
     ARControlConnectionPrivate(ARController *c, ARControlConnection *q)
         : controller(c),
-          d2c(NULL),
-          c2d(NULL),
           codec(new ARCommandCodec(q)),
-          commands(new ARCommandDictionary(q)),
+          commands(ARCommandDictionary::shared()),
+          thread(NULL),
+          transport(NULL),
+          piloting(NULL),
+          emergencyLatency(-1),
+          rtt(-1),
+          jitter(-1),
+          clockOffset(0),
+          packetLoss(0),
+          realtime(false),
+          cpuAffinity(-1),
+          batchMode(ARControlConnection::NoBatching),
           q_ptr(q)
     {/* ... */}
 
     ARController *controller;
 
-    // Device-to-Controller and Controller-to-Device sockets.
-    QUdpSocket *d2c;
-    QUdpSocket *c2d;
-
-    // Stores the current sequence ids for each frame buffer.
-    QHash<quint8, quint8> sequenceIds;
+    // Reusable buffer outgoing frames are encoded into.
+    QByteArray txBuffer;
 
     // Navdata decoding.
     ARCommandCodec *codec;
-    ARCommandDictionary *commands;
+    QSharedPointer<ARCommandDictionary> commands;
 
-    QString errorString;
+    // Network thread, and the queues to and from it.
+    QThread            *thread;
+    ARNetworkTransport *transport;
+    ARTransportQueues   queues;
 
-    // TODO: Refactor out into FrameDataProcessor? (This is deprecated, StreamV2 ftw)
-    // Video streaming data
-    quint16 frameNumber;
-    quint64 hiAck;
-    quint64 loAck;
+    ARPiloting *piloting;
+
+    // Time-to-wire of the last emergency datagram, in microseconds.
+    int emergencyLatency;
+
+    // Latest link statistics from the transport.
+    double      rtt;
+    double      jitter;
+    double      clockOffset;
+    double      packetLoss;
+    QVariantMap lossRates;
+
+    bool realtime;
+    int  cpuAffinity;
+
+    // Columnar batch decoding.
+    ARControlConnection::BatchMode batchMode;
+    ARCommandBatch batch;
+
+    QString errorString;
 
     ARControlConnection *q_ptr;
 };
@@ -58,132 +96,92 @@ ARControlConnection::ARControlConnection(ARController *controller)
     Q_D(ARControlConnection);
     ARDiscoveryDevice *device = d->controller->discoveryDevice();
 
-    DEBUG_T("Loading command dictionary data...");
-    d->commands->import(":/ARSDK/packages/libARCommands/Xml/ARDrone3_commands.xml");
-    d->commands->import(":/ARSDK/packages/libARCommands/Xml/common_commands.xml");
-    d->commands->import(":/ARSDK/packages/libARCommands/Xml/common_debug.xml");
-    d->commands->import(":/ARSDK/packages/libARCommands/Xml/SkyController_commands.xml");
+    // Reserved capacity is kept across resize(0), so steady state sends don't allocate.
+    d->txBuffer.reserve(ARNETWORK_MAX_DATAGRAM_SIZE);
 
-    DEBUG_T("Creating D2C UDP communications socket...");
-    // Setup UDP port for D2C comms.
-    d->d2c = new QUdpSocket(this);
-    d->d2c->bind(QHostAddress(d->controller->controllerAddress()),
-                 d->controller->controllerPort());
+    // Loaded in the background so connecting doesn't block, frames that need
+    // a project before it's ready wait for it.
+    DEBUG_T("Loading command projects for device...");
+    d->commands->loadProjectsAsync(d->commands->projectsForDevice(device->parameters()));
 
-    QObject::connect(d->d2c, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    DEBUG_T("Starting network thread...");
+    d->thread = new QThread(this);
+    d->thread->setObjectName("ARNetwork");
 
-    DEBUG_T("Creating C2D UDP communications socket...");
-    // Setup UDP port for C2D comms.
-    d->c2d = new QUdpSocket(this);
-    d->c2d->connectToHost(device->address(),
-                          device->parameters().value(ARDISCOVERY_KEY_C2DPORT).toInt());
-}
+    d->transport = new ARNetworkTransport(d->commands, &d->queues);
+    d->transport->moveToThread(d->thread);
 
-ARControlConnection::~ARControlConnection()
-{
-    Q_D(ARControlConnection);
-    if(d->c2d != NULL)
-    {
-        d->c2d->close();
-        d->c2d->deleteLater();
-        d->c2d = NULL;
-    }
+    QObject::connect(d->transport, SIGNAL(received()), this, SLOT(onReceived()));
+    QObject::connect(d->transport, SIGNAL(error(QString)), this, SLOT(onTransportError(QString)));
+    QObject::connect(d->transport, SIGNAL(delivered(int,int,int)), this, SIGNAL(commandDelivered(int,int,int)));
+    QObject::connect(d->transport, SIGNAL(deliveryFailed(int,int,int)), this, SIGNAL(commandDeliveryFailed(int,int,int)));
+    QObject::connect(d->transport, SIGNAL(emergencySent(qint64)), this, SLOT(onEmergencySent(qint64)));
+    QObject::connect(d->transport, SIGNAL(linkQuality(double,double,double,double,QVariantMap)),
+                     this, SLOT(onLinkQuality(double,double,double,double,QVariantMap)));
 
-    if(d->d2c != NULL)
-    {
-        d->d2c->close();
-        d->d2c->deleteLater();
-        d->d2c = NULL;
-    }
+    d->piloting = new ARPiloting(this, d->transport, &d->queues.piloting,
+                                 d->commands->projectsForDevice(device->parameters()));
 
-    delete d_ptr;
+    d->thread->start();
+
+    QMetaObject::invokeMethod(d->transport, "open", Qt::QueuedConnection,
+                              Q_ARG(QString, d->controller->controllerAddress()),
+                              Q_ARG(quint16, d->controller->controllerPort()),
+                              Q_ARG(QString, device->address()),
+                              Q_ARG(quint16, device->parameters().value(ARDISCOVERY_KEY_C2DPORT).toInt()));
 }
 
-bool ARControlConnection::sendFrame(quint8 type, quint8 id, quint8 seq, const char *data, quint32 dataSize)
+ARControlConnection::~ARControlConnection()
 {
     Q_D(ARControlConnection);
 
-    // Check we're actually able to send.
-    if(d->c2d == NULL || !d->c2d->isWritable())
-    {
-        d->errorString = "Control connection not establised.";
-        emit error();
-        return false;
-    }
-
-    QByteArray  datagram(ARNETWORK_FRAME_HEADER_SIZE + dataSize, 0x00);
-    QDataStream stream(&datagram, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::LittleEndian);
-
-    // Write frame header to buffer.
-    stream << type
-           << id
-           << seq
-           << (quint32)datagram.size();
+    // Sockets have to be closed on the thread that created them.
+    QMetaObject::invokeMethod(d->transport, "close", Qt::BlockingQueuedConnection);
 
-    // Write frame payload to buffer.
-    if(dataSize > 0) stream.writeRawData(data, dataSize);
+    d->thread->quit();
+    d->thread->wait();
 
-    qint64 result = d->c2d->write(datagram.constData(), datagram.size());
-    if(result != datagram.size())
-    {
-        //TODO: Maybe retry here ..
-        WARNING_T("Failed to send complete message");
-        return false;
-    }
-
-    if(type != ARControlConnection::LowLatencyData)
-    {
-        DEBUG_T(QString(">> %1:%2 [%3]")
-                .arg(d->c2d->peerAddress().toString())
-                .arg(d->c2d->peerPort())
-                .arg(QString(datagram.toHex())));
-    }
-
-    return true;
+    delete d->transport;
+    delete d_ptr;
 }
 
+// Sequence ids are left zero, the transport stamps them as frames are sent.
 bool ARControlConnection::sendFrame(quint8 type, quint8 id, const char *data, quint32 dataSize)
 {
     Q_D(ARControlConnection);
 
-    // Pre-populate buffer sequence id if counter doesn't already exist.
-    if(!d->sequenceIds.contains(id)) d->sequenceIds.insert(id, 0x00);
+    d->txBuffer.resize(0);
 
-    quint8 seq = d->sequenceIds.value(id);
+    int start = ARCommandCodec::beginFrame(d->txBuffer, type, id, 0x00);
+    if(dataSize > 0) d->txBuffer.append(data, dataSize);
+    ARCommandCodec::endFrame(d->txBuffer, start);
 
-    if(!this->sendFrame(type, id, seq, data, dataSize)) return false;
-
-    d->sequenceIds.insert(id, seq + 1);
-    return true;
+    return sendDatagram(d->txBuffer);
 }
 
 bool ARControlConnection::sendCommand(ARCommandInfo *command, const QVariantMap &params)
 {
     Q_D(ARControlConnection);
 
-    QByteArray  paramData = d->codec->encode(command, params);
-    QByteArray  payload(ARNETWORK_COMMAND_HEADER_SIZE + paramData.length(), 0x00);
-
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::LittleEndian);
+    // Encode frame header, command header and arguments straight into the
+    // reusable transmit buffer.
+    d->txBuffer.resize(0);
+    d->codec->encodeFrame(d->txBuffer, frameType(command->bufferId), 0x00, command, params);
 
-    stream << (quint8)command->klass->project;
-    stream << (quint8)command->klass->id;
-    stream << (quint16)command->id;
-    stream.writeRawData(paramData.constData(), paramData.length());
+    return sendDatagram(d->txBuffer);
+}
 
-    return sendFrame(ARControlConnection::Data,
-                     command->bufferId,
-                     payload.constData(),
-                     payload.size());
+QByteArray& ARControlConnection::transmitBuffer()
+{
+    Q_D(ARControlConnection);
+    return d->txBuffer;
 }
 
 bool ARControlConnection::sendCommand(int projId, int classId, int commandId, const QVariantMap &params)
 {
     Q_D(ARControlConnection);
 
-    ARCommandInfo *command = d->commands->find(projId, classId, commandId);
+    ARCommandInfo *command = d->commands->resolve(projId, classId, commandId);
     if(!command)
     {
         d->errorString = "Unable to resolve command";
@@ -194,198 +192,379 @@ bool ARControlConnection::sendCommand(int projId, int classId, int commandId, co
     return sendCommand(command, params);
 }
 
-struct ARControlFrame {
-    quint8     type;
-    quint8     id;
-    quint8     seq;
-    quint32    size;
-    QByteArray payload;
-};
+ARPreparedCommand* ARControlConnection::prepareCommand(ARCommandInfo *command)
+{
+    return new ARPreparedCommand(this, command);
+}
 
-void ARControlConnection::onReadyRead()
+ARPreparedCommand* ARControlConnection::prepareCommand(int projId, int classId, int commandId)
 {
     Q_D(ARControlConnection);
 
-    while(d->d2c->hasPendingDatagrams())
+    ARCommandInfo *command = d->commands->resolve(projId, classId, commandId);
+    if(!command)
     {
-        QHostAddress remoteAddr;
-        quint16      remotePort;
+        d->errorString = "Unable to resolve command";
+        emit error();
+        return NULL;
+    }
 
-        // If we've not received enough data, then return and wait for more.
-        if(d->d2c->pendingDatagramSize() < ARNETWORK_FRAME_HEADER_SIZE) break;
+    // Collected with the script's last reference to it, rather than living
+    // as long as the connection.
+    ARPreparedCommand *prepared = prepareCommand(command);
+    QQmlEngine::setObjectOwnership(prepared, QQmlEngine::JavaScriptOwnership);
+    return prepared;
+}
 
-        QByteArray datagram(d->d2c->pendingDatagramSize(), 0x00);
-        quint32 offset = 0;
+bool ARControlConnection::sendCommands(const QVariantList &commands)
+{
+    Q_D(ARControlConnection);
 
-        d->d2c->readDatagram(datagram.data(), datagram.size(), &remoteAddr, &remotePort);
+    // Resolve every entry before anything is encoded, so a bad entry doesn't
+    // leave the batch partly sent.
+    QVarLengthArray<ARBatchEntry, 16> entries;
+    entries.reserve(commands.size());
 
-        while(offset < datagram.size())
+    foreach(const QVariant &entry, commands)
+    {
+        ARBatchEntry resolved;
+        resolved.prepared = qobject_cast<ARPreparedCommand*>(entry.value<QObject*>());
+        resolved.command = NULL;
+
+        if(!resolved.prepared)
         {
-            ARControlFrame frame;
-            frame.type = static_cast<quint8>(datagram[offset + 0]);
-            frame.id = static_cast<quint8>(datagram[offset + 1]);
-            frame.seq = static_cast<quint8>(datagram[offset + 2]);
-            frame.size = qFromLittleEndian(*((quint32*)(datagram.constData() + offset + 3)));
-
-            // Copy datagram data to frame if the frame size is larger than just the header.
-            if(frame.size > ARNETWORK_FRAME_HEADER_SIZE)
+            resolved.params = entry.toMap();
+            resolved.command = d->commands->resolve(resolved.params.value("project").toInt(),
+                                                    resolved.params.value("class").toInt(),
+                                                    resolved.params.value("command").toInt());
+            if(!resolved.command)
             {
-                const char *data = datagram.constData();
-                frame.payload.insert(0, data + offset + ARNETWORK_FRAME_HEADER_SIZE, frame.size - ARNETWORK_FRAME_HEADER_SIZE);
+                d->errorString = "Unable to resolve command";
+                emit error();
+                return false;
             }
+        }
 
-            // Output comms debug info (if it's not a video data frame).
-            if(frame.id != ARNET_D2C_VIDEO_DATA_ID)
-            {
-                DEBUG_T(QString("<< %1:%2 [%3]")
-                        .arg(remoteAddr.toString())
-                        .arg(remotePort)
-                        .arg(QString(datagram.toHex())));
-            }
+        entries.append(resolved);
+    }
 
-            // Process frame depending on buffer id.
-            if(frame.id == ARNET_D2C_PING_ID)
-            {
-                onPing(frame);
-            }
-            else if(frame.id == ARNET_D2C_EVENT_ID || frame.id == ARNET_D2C_NAVDATA_ID)
-            {
-                onNavdata(frame);
-            }
-            else if(frame.id == ARNET_D2C_VIDEO_DATA_ID)
-            {
-                onVideoData(frame);
-            }
-            else
-            {
-                WARNING_T(QString("Unhandled frame id: %1").arg(frame.id));
-            }
+    // Encode every frame, remembering where each one ends.
+    QVarLengthArray<int, 16> ends;
+    d->txBuffer.resize(0);
+
+    for(int i = 0; i < entries.size(); i++)
+    {
+        const ARBatchEntry &entry = entries.at(i);
+        int start = d->txBuffer.size();
 
-            // Increment datagram offset to continue processing next frame.
-            offset += frame.size;
+        if(entry.prepared)
+        {
+            d->txBuffer.append(entry.prepared->frame());
+        }
+        else
+        {
+            d->codec->encodeFrame(d->txBuffer, frameType(entry.command->bufferId), 0x00, entry.command, entry.params.value("params").toMap());
         }
+
+        if(d->txBuffer.size() - start > ARNETWORK_MAX_DATAGRAM_SIZE)
+        {
+            d->errorString = "Command too large for a datagram.";
+            emit error();
+            return false;
+        }
+
+        ends.append(d->txBuffer.size());
+    }
+
+    // Emergency frames go out first, each as an urgent datagram of its own,
+    // and the other frames are moved down over them.
+    char *data = d->txBuffer.data();
+    int begin = 0;
+    int packed = 0;
+    int count = 0;
+
+    for(int i = 0; i < ends.size(); i++)
+    {
+        int frameEnd = ends.at(i);
+        int size = frameEnd - begin;
+
+        if(static_cast<quint8>(data[begin + 1]) == ARNET_C2D_EMERG_ID)
+        {
+            if(!sendDatagram(data + begin, size, true)) return false;
+        }
+        else
+        {
+            if(packed != begin) std::memmove(data + packed, data + begin, size);
+            packed += size;
+            ends[count++] = packed;
+        }
+
+        begin = frameEnd;
     }
+
+    ends.resize(count);
+
+    // Pack the remaining frames into as few datagrams as possible.
+    int start = 0;
+    int end = 0;
+
+    for(int i = 0; i < ends.size(); i++)
+    {
+        if(ends.at(i) - start > ARNETWORK_MAX_DATAGRAM_SIZE)
+        {
+            if(!sendDatagram(d->txBuffer.constData() + start, end - start)) return false;
+            start = end;
+        }
+
+        end = ends.at(i);
+    }
+
+    if(end == start) return true;
+
+    return sendDatagram(d->txBuffer.constData() + start, end - start);
 }
 
-// TODO: Keep-Alive timer for connectivity monitoring.
-//       Monitor latency/frequency for signal quality.
-void ARControlConnection::onPing(const ARControlFrame &frame)
+bool ARControlConnection::sendEncodedFrame(const QByteArray &frame, bool urgent)
 {
-    sendFrame(frame.type,
-              (quint8)ARNET_C2D_PONG_ID,
-              frame.seq,
-              frame.payload.data(),
-              frame.payload.size());
+    return sendDatagram(frame.constData(), frame.size(), urgent);
 }
 
-void ARControlConnection::onNavdata(const ARControlFrame &frame)
+ARControlConnection::FrameType ARControlConnection::frameType(quint8 bufferId)
 {
-    Q_D(ARControlConnection);
+    // Frames on these buffers are acknowledged, and retransmitted until they are.
+    if(bufferId == ARNET_C2D_ACK_ID || bufferId == ARNET_C2D_EMERG_ID) return AcknowledgeData;
+    return Data;
+}
 
-    // TODO: Should we do this, or should we allow application to decide
-    // when/if an acknowledge occurs?
-    // Construct acknowledge frame, if this incoming frame requires it.
-    if(frame.type == ARControlConnection::AcknowledgeData)
+ARPiloting* ARControlConnection::piloting() const
+{
+    Q_D(const ARControlConnection);
+    return d->piloting;
+}
+
+ARCommandDictionary* ARControlConnection::dictionary() const
+{
+    Q_D(const ARControlConnection);
+    return d->commands.data();
+}
+
+ARCommandCodec* ARControlConnection::codec() const
+{
+    Q_D(const ARControlConnection);
+    return d->codec;
+}
+
+ARControlConnection::BatchMode ARControlConnection::batchMode() const
+{
+    Q_D(const ARControlConnection);
+    return d->batchMode;
+}
+
+void ARControlConnection::setBatchMode(BatchMode mode)
+{
+    Q_D(ARControlConnection);
+    if(d->batchMode != mode)
     {
-        QByteArray payload(1, 0x00);
-        QDataStream datastream(&payload, QIODevice::WriteOnly);
-        datastream.setByteOrder(QDataStream::LittleEndian);
-        datastream << (quint8)frame.seq;
-        sendFrame(ARControlConnection::Acknowledge, ARNET_C2D_NAVDATA_ACK_ID, payload.constData(), payload.size());
+        d->batchMode = mode;
+        d->batch.clear();
+
+        // Batches need every command, not just those listened for.
+        QMetaObject::invokeMethod(d->transport, "setFiltering", Qt::QueuedConnection,
+                                  Q_ARG(bool, mode == ARControlConnection::NoBatching));
+        emit batchModeChanged();
     }
+}
 
-    // Decode command header.
-    quint8  project  = static_cast<quint8>(frame.payload[0]);
-    quint8  klass    = static_cast<quint8>(frame.payload[1]);
-    quint16 id       = qFromLittleEndian(static_cast<quint16>(frame.payload[2]));
-    const char *data = frame.payload.data() + 4;
+bool ARControlConnection::sendDatagram(const QByteArray &datagram)
+{
+    return sendDatagram(datagram.constData(), datagram.size());
+}
 
-    // Resolve command meta-type information.
-    ARCommandInfo *command = d->commands->find(project, klass, id);
-    if(command == NULL)
+bool ARControlConnection::realtime() const
+{
+    Q_D(const ARControlConnection);
+    return d->realtime;
+}
+
+void ARControlConnection::setRealtime(bool realtime)
+{
+    Q_D(ARControlConnection);
+    if(d->realtime != realtime)
     {
-        WARNING_T(QString("Unrecognised command: %1 %2 %3")
-                  .arg(project)
-                  .arg(klass)
-                  .arg(id));
-        return;
+        d->realtime = realtime;
+        QMetaObject::invokeMethod(d->transport, "setRealtime", Qt::QueuedConnection, Q_ARG(bool, realtime));
+        emit realtimeChanged();
     }
+}
 
-    // Use command codec to decode command parameters.
-    QVariantMap params = d->codec->decode(command, data);
-    DEBUG_T(QString("Decoded Command %1 %2 %3").arg(command->klass->project).arg(command->klass->name).arg(command->name));
+int ARControlConnection::cpuAffinity() const
+{
+    Q_D(const ARControlConnection);
+    return d->cpuAffinity;
+}
 
-    d->controller->onCommandReceived(*command, params);
+void ARControlConnection::setCpuAffinity(int cpu)
+{
+    Q_D(ARControlConnection);
+    if(d->cpuAffinity != cpu)
+    {
+        d->cpuAffinity = cpu;
+        QMetaObject::invokeMethod(d->transport, "setCpuAffinity", Qt::QueuedConnection, Q_ARG(int, cpu));
+        emit cpuAffinityChanged();
+    }
 }
 
-void ARControlConnection::onVideoData(const ARControlFrame &frame)
+void ARControlConnection::setInterest(const QBitArray &interest, const QBitArray &everySample)
 {
-    TRACE
     Q_D(ARControlConnection);
+    QMetaObject::invokeMethod(d->transport, "setInterest", Qt::QueuedConnection,
+                              Q_ARG(QBitArray, interest), Q_ARG(QBitArray, everySample));
+}
 
-    quint16 frameNumber = qFromLittleEndian(*((quint16*)(frame.payload.constData())));
-    quint8  frameFlags = static_cast<quint8>(frame.payload[2]);
-    quint8  fragmentNumber = static_cast<quint8>(frame.payload[3]);
-    quint8  fragsPerFrame = static_cast<quint8>(frame.payload[4]);
+// Datagrams are copied into the send queue and written by the network thread.
+bool ARControlConnection::sendDatagram(const char *data, int size, bool urgent)
+{
+    Q_D(ARControlConnection);
 
-    if(frameNumber != d->frameNumber)
+    if(size > ARNETWORK_MAX_DATAGRAM_SIZE)
     {
-        if(frameFlags == 0x01)
-        {
-            DEBUG_T(QString("Video Key Frame Header [%1] (%2 %3 %4)")
-                    .arg(QString(QByteArray().append(frame.payload.constData(), 5).toHex()))
-                    .arg(frameNumber)
-                    .arg(fragmentNumber)
-                    .arg(fragsPerFrame));
-        }
-        else
-        {
-            DEBUG_T(QString("Video Frame Header (%2 %3 %4)")
-                    .arg(frameNumber)
-                    .arg(fragmentNumber)
-                    .arg(fragsPerFrame));
-        }
+        d->errorString = "Datagram too large.";
+        emit error();
+        return false;
+    }
 
-        if(fragsPerFrame < 64)
-        {
-            d->hiAck = 0xffffffffffffffff;
-            d->loAck = 0xffffffffffffffff << fragsPerFrame;
-        }
-        else if(fragsPerFrame < 128)
-        {
-            d->hiAck = 0xffffffffffffffff << (fragsPerFrame - 64);
-            d->loAck = 0ll;
-        }
-        else
-        {
-            d->hiAck = 0ll;
-            d->loAck = 0ll;
-        }
+    // Anything with a frame on the emergency buffer jumps the queue.
+    for(int offset = 0; !urgent && offset + ARNETWORK_FRAME_HEADER_SIZE <= size; )
+    {
+        if(static_cast<quint8>(data[offset + 1]) == ARNET_C2D_EMERG_ID) urgent = true;
 
-        d->frameNumber = frameNumber;
+        quint32 frameSize = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(data + offset + 3));
+        if(frameSize < ARNETWORK_FRAME_HEADER_SIZE || frameSize > quint32(size - offset)) break;
+        offset += frameSize;
     }
 
-    if(fragmentNumber < 64)
+    ARSpscQueue<AROutgoingDatagram> &queue = urgent ? d->queues.emergency : d->queues.outgoing;
+
+    AROutgoingDatagram *datagram = queue.push();
+    if(datagram == NULL)
     {
-        d->loAck |= (1ll << fragmentNumber);
+        d->errorString = "Send queue full.";
+        emit error();
+        return false;
     }
-    else if(fragmentNumber < 128)
+
+    datagram->queuedAt = d->queues.clock.nsecsElapsed();
+    datagram->size = size;
+    std::memcpy(datagram->data, data, size);
+    queue.commit();
+
+    if(d->queues.outgoingSignalled.testAndSetOrdered(0, 1))
     {
-        d->hiAck |= (1ll << (fragmentNumber - 64));
+        QMetaObject::invokeMethod(d->transport, "flush", Qt::QueuedConnection);
     }
 
-    // Construct reply.
-    QByteArray payload(2 + 8 + 8, 0x00);
-    QDataStream datastream(&payload, QIODevice::WriteOnly);
+    return true;
+}
+
+void ARControlConnection::onReceived()
+{
+    Q_D(ARControlConnection);
+
+    // Cleared first, so commands queued while draining signal again.
+    d->queues.receivedSignalled.storeRelease(0);
+
+    quint32 datagram = 0;
+
+    while(ARReceivedCommand *entry = d->queues.received.front())
+    {
+        // Fields are only decoded from the queue slot as they're read.
+        ARDecodedCommand decoded = d->codec->decode(entry->command, entry->payload, entry->size);
+        DEBUG_T(QString("Decoded Command %1 %2 %3")
+                .arg(entry->command->klass->project)
+                .arg(*entry->command->klass->name)
+                .arg(*entry->command->name));
+
+        if(d->batchMode != ARControlConnection::NoBatching)
+        {
+            if(d->batchMode == ARControlConnection::DatagramBatching && entry->datagram != datagram) flushBatch();
+            d->batch.append(decoded, entry->timestamp);
+            datagram = entry->datagram;
+        }
+
+        d->controller->onCommandReceived(decoded);
+        d->queues.received.pop();
+    }
+
+    flushBatch();
+}
+
+int ARControlConnection::emergencyLatency() const
+{
+    Q_D(const ARControlConnection);
+    return d->emergencyLatency;
+}
+
+void ARControlConnection::onEmergencySent(qint64 latency)
+{
+    Q_D(ARControlConnection);
+    d->emergencyLatency = int(latency / 1000);
+    emit emergencyLatencyChanged();
+}
+
+double ARControlConnection::rtt() const
+{
+    Q_D(const ARControlConnection);
+    return d->rtt;
+}
 
-    if(!d->sequenceIds.contains(ARNET_C2D_VIDEO_ACK_ID))
-        d->sequenceIds.insert(ARNET_C2D_VIDEO_ACK_ID, 0x00);
+double ARControlConnection::jitter() const
+{
+    Q_D(const ARControlConnection);
+    return d->jitter;
+}
+
+double ARControlConnection::clockOffset() const
+{
+    Q_D(const ARControlConnection);
+    return d->clockOffset;
+}
+
+double ARControlConnection::packetLoss() const
+{
+    Q_D(const ARControlConnection);
+    return d->packetLoss;
+}
+
+QVariantMap ARControlConnection::lossRates() const
+{
+    Q_D(const ARControlConnection);
+    return d->lossRates;
+}
+
+void ARControlConnection::onLinkQuality(double rtt, double jitter, double clockOffset, double loss, const QVariantMap &lossRates)
+{
+    Q_D(ARControlConnection);
+    d->rtt = rtt;
+    d->jitter = jitter;
+    d->clockOffset = clockOffset;
+    d->packetLoss = loss;
+    d->lossRates = lossRates;
+    emit linkQualityChanged();
+}
+
+void ARControlConnection::onTransportError(const QString &message)
+{
+    Q_D(ARControlConnection);
+    d->errorString = message;
+    emit error();
+}
+
+void ARControlConnection::flushBatch()
+{
+    Q_D(ARControlConnection);
 
-    datastream.setByteOrder(QDataStream::LittleEndian);
-    datastream
-            << (quint16)frameNumber
-            << (quint64)d->hiAck
-            << (quint64)d->loAck;
+    if(d->batch.isEmpty()) return;
 
-    sendFrame(ARControlConnection::LowLatencyData, ARNET_C2D_VIDEO_ACK_ID, payload.constData(), payload.size());
+    emit batchDecoded(&d->batch);
+    d->batch.clear();
 }
@@ -2,18 +2,36 @@
 #define ARCONTROLCONNECTION_H
 
 #include <QObject>
+#include <QBitArray>
 #include <QVariantMap>
 
+#include "arpiloting.h"
+#include "arcommandcodec.h"
+
 class ARController;
-class ARControlFrame;
 
 class ARCommandInfo;
 class ARCommandListener;
+class ARCommandBatch;
+class ARCommandDictionary;
+class ARPreparedCommand;
 
 class ARControlConnection : public QObject
 {
     Q_OBJECT
 
+    Q_PROPERTY(ARPiloting* piloting READ piloting CONSTANT)
+    Q_PROPERTY(int emergencyLatency READ emergencyLatency NOTIFY emergencyLatencyChanged)
+
+    Q_PROPERTY(double rtt READ rtt NOTIFY linkQualityChanged)
+    Q_PROPERTY(double jitter READ jitter NOTIFY linkQualityChanged)
+    Q_PROPERTY(double clockOffset READ clockOffset NOTIFY linkQualityChanged)
+    Q_PROPERTY(double packetLoss READ packetLoss NOTIFY linkQualityChanged)
+    Q_PROPERTY(QVariantMap lossRates READ lossRates NOTIFY linkQualityChanged)
+    Q_PROPERTY(BatchMode batchMode READ batchMode WRITE setBatchMode NOTIFY batchModeChanged)
+    Q_PROPERTY(bool realtime READ realtime WRITE setRealtime NOTIFY realtimeChanged)
+    Q_PROPERTY(int cpuAffinity READ cpuAffinity WRITE setCpuAffinity NOTIFY cpuAffinityChanged)
+
 public:
     typedef enum {
         NotInitialized = 0,
@@ -23,27 +41,125 @@ public:
         AcknowledgeData
     } FrameType;
 
+    typedef enum {
+        NoBatching = 0,     // Commands are only dispatched to listeners.
+        DatagramBatching,   // Also collect decoded commands per datagram.
+        BurstBatching       // Also collect decoded commands per readyRead burst.
+    } BatchMode;
+    Q_ENUMS(BatchMode)
+
     explicit ARControlConnection(ARController *controller);
             ~ARControlConnection();
 
-    bool sendFrame(quint8 type, quint8 id, quint8 seq, const char *data, quint32 dataSize);
     Q_INVOKABLE bool sendFrame(quint8 type, quint8 id, const char* data, quint32 dataSize);
 
     Q_INVOKABLE bool sendCommand(ARCommandInfo *command, const QVariantMap &params);
     Q_INVOKABLE bool sendCommand(int projId, int classId, int commandId, const QVariantMap &params);
 
+    // Resolve and pre-encode a command for repeated sending. The handle is
+    // owned by the caller, or by the JavaScript engine when called from QML.
+    ARPreparedCommand* prepareCommand(ARCommandInfo *command);
+    Q_INVOKABLE ARPreparedCommand* prepareCommand(int projId, int classId, int commandId);
+
+    // Send several commands, packing their frames into as few datagrams as
+    // possible. Each entry is either an ARPreparedCommand or a map with
+    // "project", "class", "command" ids and optional "params".
+    Q_INVOKABLE bool sendCommands(const QVariantList &commands);
+
+    // Send an already encoded frame, its sequence id is stamped when the
+    // network thread sends it. Urgent frames go ahead of everything else, as
+    // frames on the emergency buffer always do.
+    bool sendEncodedFrame(const QByteArray &frame, bool urgent = false);
+
+    // Send a generated command struct (see tools/arcommandsgen.py), skipping
+    // the dictionary lookup and QVariant arguments. Encoded straight into the
+    // reusable transmit buffer, as sendCommand() does.
+    template<typename C> bool send(const C &command)
+    {
+        QByteArray &buffer = transmitBuffer();
+        buffer.resize(0);
+
+        if(!ARCommandCodec::encodeFrame(buffer, frameType(C::bufferId), 0x00, command)) return false;
+        return sendDatagram(buffer);
+    }
+
+    // Frame type commands on the given buffer are sent with.
+    static FrameType frameType(quint8 bufferId);
+
+    ARPiloting* piloting() const;
+
+    // Microseconds between queueing the last emergency frame and writing it
+    // to the socket, -1 if none was sent yet.
+    int emergencyLatency() const;
+
+    // Link quality, updated twice a second. Round trip time of pings and its
+    // jitter in milliseconds, -1 until the first pong.
+    double rtt() const;
+    double jitter() const;
+
+    // Device clock minus the system's monotonic clock in milliseconds,
+    // estimated from the device's pings.
+    double clockOffset() const;
+
+    // Fraction of frames lost from received sequences over the last update,
+    // overall and by buffer id.
+    double packetLoss() const;
+    QVariantMap lossRates() const;
+    ARCommandDictionary* dictionary() const;
+    ARCommandCodec* codec() const;
+
+    BatchMode batchMode() const;
+    Q_INVOKABLE void setBatchMode(BatchMode mode);
+
+    // Run the network thread with a realtime scheduling policy, where the
+    // platform allows it.
+    bool realtime() const;
+    void setRealtime(bool realtime);
+
+    // Pin the network thread to a CPU, -1 lets it run on any.
+    int  cpuAffinity() const;
+    void setCpuAffinity(int cpu);
+
 Q_SIGNALS:
     void error();
 
+    // A command sent on an acknowledged buffer was acknowledged by the
+    // device, or given up on after its retries ran out.
+    void commandDelivered(int projectId, int classId, int commandId);
+    void commandDeliveryFailed(int projectId, int classId, int commandId);
+
+    void batchModeChanged();
+    void realtimeChanged();
+    void cpuAffinityChanged();
+    void emergencyLatencyChanged();
+    void linkQualityChanged();
+
+    // Emitted with the commands decoded since the last batch, the batch is
+    // only valid for the duration of the emission and reused right after.
+    // Only connect to it directly, a queued slot would see a cleared batch.
+    void batchDecoded(const ARCommandBatch *batch);
+
 protected Q_SLOTS:
-    void onReadyRead();
+    void onReceived();
+    void onTransportError(const QString &message);
+    void onEmergencySent(qint64 latency);
+    void onLinkQuality(double rtt, double jitter, double clockOffset, double loss, const QVariantMap &lossRates);
 
 protected:
-    void onPing(const ARControlFrame &frame);
-    void onNavdata(const ARControlFrame &frame);
-    void onVideoData(const ARControlFrame &frame);
+    // Reused by every send on the GUI thread, its capacity is reserved.
+    QByteArray& transmitBuffer();
+
+    bool sendDatagram(const QByteArray &datagram);
+    bool sendDatagram(const char *data, int size, bool urgent = false);
+
+    // Commands the controller has listeners for, filtered on the network thread.
+    void setInterest(const QBitArray &interest, const QBitArray &everySample);
+
+    void flushBatch();
 
 private:
+    friend class ARController;
+
     class ARControlConnectionPrivate *d_ptr;
     Q_DECLARE_PRIVATE(ARControlConnection)
 };
@@ -25,9 +25,11 @@
 #include "ardiscoverydevice.h"
 #include "arcontrolconnection.h"
 
+#include "arcommandcodec.h"
 #include "arcommanddictionary.h"
 #include "arcommandlistener.h"
 
+#include <QBitArray>
 #include <QDir>
 #include <QFile>
 #include <QDateTime>
@@ -175,14 +177,42 @@ void ARController::setControllerPort(quint16 controllerPort)
 
 QQmlListProperty<ARCommandListener> ARController::commandListeners()
 {
-    Q_D(ARController);
-    return QQmlListProperty<ARCommandListener>(this, d->listeners);
+    // Modifications go through add/removeCommandListener(), so interest and
+    // signal connections stay in sync with the list.
+    return QQmlListProperty<ARCommandListener>(this, NULL,
+                                               &ARController::listenersAppend,
+                                               &ARController::listenersCount,
+                                               &ARController::listenersAt,
+                                               &ARController::listenersClear);
 }
 
-int ARController::appendCommandListener(const QString &command, QVariant param)
+void ARController::listenersAppend(QQmlListProperty<ARCommandListener> *property, ARCommandListener *listener)
 {
-    Q_D(ARController);
+    if(listener == NULL) return;
+    static_cast<ARController*>(property->object)->addCommandListener(listener);
+}
+
+int ARController::listenersCount(QQmlListProperty<ARCommandListener> *property)
+{
+    return static_cast<ARController*>(property->object)->d_func()->listeners.size();
+}
+
+ARCommandListener* ARController::listenersAt(QQmlListProperty<ARCommandListener> *property, int index)
+{
+    return static_cast<ARController*>(property->object)->d_func()->listeners.value(index, NULL);
+}
+
+void ARController::listenersClear(QQmlListProperty<ARCommandListener> *property)
+{
+    ARController *controller = static_cast<ARController*>(property->object);
+    foreach(ARCommandListener *listener, controller->d_func()->listeners)
+    {
+        controller->removeCommandListener(listener);
+    }
+}
 
+int ARController::appendCommandListener(const QString &command, QVariant param)
+{
     // Check that provided parameter is invokable.
     QJSValue jsvalue;
     if(param.userType() != qMetaTypeId<QJSValue>()) return -1;
@@ -191,15 +221,30 @@ int ARController::appendCommandListener(const QString &command, QVariant param)
 
     // Build command listener.
     ARCommandListener *listener = new ARCommandListener(this);
-    listener->setListenerId(d->currentCommandListenerId++);
     listener->setCommandName(command);
     listener->setCallback(param);
 
+    return addCommandListener(listener);
+}
+
+int ARController::addCommandListener(ARCommandListener *listener)
+{
+    Q_D(ARController);
+    if(d->listeners.contains(listener)) return listener->listenerId();
+
+    listener->setListenerId(d->currentCommandListenerId++);
+
+    QObject::connect(listener, SIGNAL(projectIdChanged()), this, SLOT(updateInterest()));
+    QObject::connect(listener, SIGNAL(classNameChanged()), this, SLOT(updateInterest()));
+    QObject::connect(listener, SIGNAL(commandNameChanged()), this, SLOT(updateInterest()));
+    QObject::connect(listener, SIGNAL(everySampleChanged()), this, SLOT(updateInterest()));
+
     // Register command listener
     d->listeners.append(listener);
+    updateInterest();
     emit commandListenersChanged();
 
-    return d->currentCommandListenerId - 1;
+    return listener->listenerId();
 }
 
 void ARController::removeCommandListener(int handlerId)
@@ -208,13 +253,31 @@ void ARController::removeCommandListener(int handlerId)
     foreach(ARCommandListener *target, d->listeners) {
         if(target->listenerId() == handlerId)
         {
-            d->listeners.removeOne(target);
-            emit commandListenersChanged();
+            removeCommandListener(target);
             break;
         }
     }
 }
 
+void ARController::removeCommandListener(ARCommandListener *listener)
+{
+    Q_D(ARController);
+    if(!d->listeners.removeOne(listener)) return;
+
+    listener->disconnect(this);
+    updateInterest();
+    emit commandListenersChanged();
+}
+
+ARCommandListener* ARController::commandListener(int handlerId) const
+{
+    Q_D(const ARController);
+    foreach(ARCommandListener *listener, d->listeners) {
+        if(listener->listenerId() == handlerId) return listener;
+    }
+    return NULL;
+}
+
 ARDiscoveryDevice* ARController::discoveryDevice() const
 {
     Q_D(const ARController);
@@ -311,6 +374,7 @@ void ARController::shutdown()
         DEBUG_T("Destroying control connection.");
         d->connection->deleteLater();
         d->connection = NULL;
+        updateInterest();
     }
 
     d->status = ARController::Disconnected;
@@ -328,6 +392,11 @@ void ARController::onDiscovered(ARDiscoveryDevice *device)
     DEBUG_T("Device discovered, connecting...");
     d->connection = new ARControlConnection(this);
 
+    // Commands of lazily loaded projects need to be matched against listeners too.
+    QObject::connect(d->connection->dictionary(), SIGNAL(projectLoaded(quint8)),
+                     this, SLOT(updateInterest()), Qt::UniqueConnection);
+    updateInterest();
+
     d->status = ARController::Connecting;
     emit statusChanged();
 
@@ -351,15 +420,56 @@ void ARController::onDiscoveryError()
     emit statusChanged();
 }
 
-void ARController::onCommandReceived(const ARCommandInfo &command, const QVariantMap &params)
+// The bitmaps are indexed by ARCommandInfo::index, of commands with at least
+// one listener, and of those with one that wants every sample. They're handed
+// to the connection, which filters on the network thread.
+void ARController::updateInterest()
+{
+    Q_D(ARController);
+
+    if(!d->connection) return;
+
+    QList<ARCommandInfo*> commands = d->connection->dictionary()->commands();
+    QBitArray interest(commands.size());
+    QBitArray everySample(commands.size());
+
+    foreach(ARCommandInfo *command, commands)
+    {
+        foreach(ARCommandListener *listener, d->listeners)
+        {
+            if(!listener->matches(*command)) continue;
+
+            interest.setBit(command->index);
+            if(listener->everySample()) everySample.setBit(command->index);
+        }
+    }
+
+    d->connection->setInterest(interest, everySample);
+}
+
+void ARController::onCommandReceived(const ARDecodedCommand &command)
 {
     TRACE
     Q_D(const ARController);
 
+    // Only convert to a variant map if somebody is listening, at most once
+    // for each enumeration representation.
+    QVariantMap maps[2];
+    bool        decoded[2] = { false, false };
+
     foreach(ARCommandListener *listener, d->listeners)
     {
-        if(listener->commandName() == command.name)
+        if(listener->matches(*command.command()))
         {
+            int form = listener->enumNames() ? 1 : 0;
+            if(!decoded[form])
+            {
+                maps[form] = command.toVariantMap(listener->enumNames());
+                decoded[form] = true;
+            }
+
+            const QVariantMap &params = maps[form];
+
             if(!listener->callback().isNull()) {
                 QJSValue callback = qvariant_cast<QJSValue>(listener->callback());
                 QJSValue jsParams = callback.engine()->newObject();
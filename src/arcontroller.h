@@ -29,6 +29,7 @@ class ARControlConnection;
 
 class ARCommandInfo;
 class ARCommandListener;
+class ARDecodedCommand;
 
 class ARController : public QObject
 {
@@ -87,6 +88,11 @@ public:
     Q_INVOKABLE int  appendCommandListener(const QString &command, QVariant callback);
     Q_INVOKABLE void removeCommandListener(int handlerId);
 
+    // Register an existing listener, such as one declared in QML, returns its id.
+    int  addCommandListener(ARCommandListener *listener);
+    void removeCommandListener(ARCommandListener *listener);
+    Q_INVOKABLE ARCommandListener* commandListener(int handlerId) const;
+
     ARDiscoveryDevice* discoveryDevice() const;
     ARControlConnection* connection() const;
 
@@ -129,9 +135,16 @@ protected Q_SLOTS:
     void onDiscovered(ARDiscoveryDevice *discoveryDevice);
     void onDiscoveryError();
 
-    void onCommandReceived(const ARCommandInfo &command, const QVariantMap &params);
+    void onCommandReceived(const ARDecodedCommand &command);
+
+    void updateInterest();
 
 private:
+    static void listenersAppend(QQmlListProperty<ARCommandListener> *property, ARCommandListener *listener);
+    static int  listenersCount(QQmlListProperty<ARCommandListener> *property);
+    static ARCommandListener* listenersAt(QQmlListProperty<ARCommandListener> *property, int index);
+    static void listenersClear(QQmlListProperty<ARCommandListener> *property);
+
     class ARControllerPrivate *d_ptr;
     Q_DECLARE_PRIVATE(ARController)
 };
@@ -0,0 +1,303 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include "arnativeudpsocket.h"
+
+#include "common.h"
+#include "config.h"
+
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class ARNativeUdpSocketPrivate
+{
+public:
+    ARNativeUdpSocketPrivate()
+        : fd(-1),
+          notifier(NULL),
+          peerPort(0),
+          txCount(0),
+          syscalls(0),
+          datagrams(0)
+    {
+        std::memset(rxMessages, 0, sizeof(rxMessages));
+        std::memset(txMessages, 0, sizeof(txMessages));
+
+        // The vectors always point at the same buffers, only lengths change.
+        for(int i = 0; i < ARNETWORK_BATCH_SIZE; i++)
+        {
+            rxVectors[i].iov_base = rxBuffers[i];
+            rxVectors[i].iov_len = ARNETWORK_MAX_DATAGRAM_SIZE;
+            rxMessages[i].msg_hdr.msg_iov = &rxVectors[i];
+            rxMessages[i].msg_hdr.msg_iovlen = 1;
+
+            txVectors[i].iov_base = txBuffers[i];
+            txMessages[i].msg_hdr.msg_iov = &txVectors[i];
+            txMessages[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    int fd;
+    QSocketNotifier *notifier;
+
+    QString errorString;
+
+    QHostAddress peerAddress;
+    quint16      peerPort;
+
+    // Preallocated receive batch.
+    mmsghdr rxMessages[ARNETWORK_BATCH_SIZE];
+    iovec   rxVectors[ARNETWORK_BATCH_SIZE];
+    char    rxBuffers[ARNETWORK_BATCH_SIZE][ARNETWORK_MAX_DATAGRAM_SIZE];
+
+    // Preallocated send batch, of which txCount are queued.
+    mmsghdr txMessages[ARNETWORK_BATCH_SIZE];
+    iovec   txVectors[ARNETWORK_BATCH_SIZE];
+    char    txBuffers[ARNETWORK_BATCH_SIZE][ARNETWORK_MAX_DATAGRAM_SIZE];
+    int     txCount;
+
+    quint64 syscalls;
+    quint64 datagrams;
+};
+
+static sockaddr_in toSockAddr(const QHostAddress &address, quint16 port)
+{
+    sockaddr_in result;
+    std::memset(&result, 0, sizeof(result));
+    result.sin_family = AF_INET;
+    result.sin_port = htons(port);
+    result.sin_addr.s_addr = htonl(address.toIPv4Address());
+    return result;
+}
+
+ARNativeUdpSocket::ARNativeUdpSocket(QObject *parent)
+    : QObject(parent), d_ptr(new ARNativeUdpSocketPrivate)
+{/* ... */}
+
+ARNativeUdpSocket::~ARNativeUdpSocket()
+{
+    close();
+    delete d_ptr;
+}
+
+bool ARNativeUdpSocket::open()
+{
+    Q_D(ARNativeUdpSocket);
+
+    if(d->fd != -1) return true;
+
+    d->fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(d->fd == -1)
+    {
+        d->errorString = QString::fromLocal8Bit(std::strerror(errno));
+        return false;
+    }
+
+    d->notifier = new QSocketNotifier(d->fd, QSocketNotifier::Read, this);
+    QObject::connect(d->notifier, SIGNAL(activated(int)), this, SIGNAL(readyRead()));
+
+    return true;
+}
+
+bool ARNativeUdpSocket::bind(const QHostAddress &address, quint16 port)
+{
+    Q_D(ARNativeUdpSocket);
+
+    if(!open()) return false;
+
+    sockaddr_in local = toSockAddr(address, port);
+    if(::bind(d->fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == -1)
+    {
+        d->errorString = QString::fromLocal8Bit(std::strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool ARNativeUdpSocket::connectToHost(const QHostAddress &address, quint16 port)
+{
+    Q_D(ARNativeUdpSocket);
+
+    if(!open()) return false;
+
+    sockaddr_in remote = toSockAddr(address, port);
+    if(::connect(d->fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) == -1)
+    {
+        d->errorString = QString::fromLocal8Bit(std::strerror(errno));
+        return false;
+    }
+
+    d->peerAddress = address;
+    d->peerPort = port;
+    return true;
+}
+
+void ARNativeUdpSocket::close()
+{
+    Q_D(ARNativeUdpSocket);
+
+    if(d->fd == -1) return;
+
+    delete d->notifier;
+    d->notifier = NULL;
+
+    ::close(d->fd);
+    d->fd = -1;
+    d->txCount = 0;
+}
+
+bool ARNativeUdpSocket::isOpen() const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->fd != -1;
+}
+
+QString ARNativeUdpSocket::errorString() const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->errorString;
+}
+
+QHostAddress ARNativeUdpSocket::peerAddress() const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->peerAddress;
+}
+
+quint16 ARNativeUdpSocket::peerPort() const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->peerPort;
+}
+
+int ARNativeUdpSocket::receive()
+{
+    Q_D(ARNativeUdpSocket);
+
+    if(d->fd == -1) return -1;
+
+    int result;
+    do
+    {
+        result = ::recvmmsg(d->fd, d->rxMessages, ARNETWORK_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        d->syscalls++;
+    }
+    while(result == -1 && errno == EINTR);
+
+    if(result == -1)
+    {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+        d->errorString = QString::fromLocal8Bit(std::strerror(errno));
+        return -1;
+    }
+
+    d->datagrams += result;
+    return result;
+}
+
+const char* ARNativeUdpSocket::datagram(int index) const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->rxBuffers[index];
+}
+
+int ARNativeUdpSocket::datagramSize(int index) const
+{
+    Q_D(const ARNativeUdpSocket);
+
+    // Anything that didn't fit the buffer is incomplete, treat it as empty.
+    if(d->rxMessages[index].msg_hdr.msg_flags & MSG_TRUNC) return 0;
+    return d->rxMessages[index].msg_len;
+}
+
+bool ARNativeUdpSocket::write(const char *data, int size)
+{
+    Q_D(ARNativeUdpSocket);
+
+    if(d->fd == -1)
+    {
+        d->errorString = "Socket not open.";
+        return false;
+    }
+
+    if(size > ARNETWORK_MAX_DATAGRAM_SIZE)
+    {
+        d->errorString = "Datagram too large.";
+        return false;
+    }
+
+    if(d->txCount == ARNETWORK_BATCH_SIZE && !flush()) return false;
+
+    std::memcpy(d->txBuffers[d->txCount], data, size);
+    d->txVectors[d->txCount].iov_len = size;
+    d->txCount++;
+
+    return true;
+}
+
+bool ARNativeUdpSocket::flush()
+{
+    Q_D(ARNativeUdpSocket);
+
+    int sent = 0;
+    while(sent < d->txCount)
+    {
+        int result = ::sendmmsg(d->fd, d->txMessages + sent, d->txCount - sent, 0);
+        d->syscalls++;
+
+        if(result == -1)
+        {
+            if(errno == EINTR) continue;
+
+            // Datagrams are dropped rather than kept, as with QUdpSocket.
+            d->errorString = QString::fromLocal8Bit(std::strerror(errno));
+            WARNING_T(QString("Dropped %1 datagrams: %2").arg(d->txCount - sent).arg(d->errorString));
+            d->txCount = 0;
+            return false;
+        }
+
+        sent += result;
+        d->datagrams += result;
+    }
+
+    d->txCount = 0;
+    return true;
+}
+
+quint64 ARNativeUdpSocket::syscallCount() const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->syscalls;
+}
+
+quint64 ARNativeUdpSocket::datagramCount() const
+{
+    Q_D(const ARNativeUdpSocket);
+    return d->datagrams;
+}
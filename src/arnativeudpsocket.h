@@ -0,0 +1,78 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARNATIVEUDPSOCKET_H
+#define ARNATIVEUDPSOCKET_H
+
+#include <QObject>
+#include <QHostAddress>
+
+// Linux UDP socket that reads and writes datagrams in batches, with one
+// recvmmsg() or sendmmsg() call per batch. The saving over QUdpSocket grows
+// with the burst size: when datagrams arrive one per wakeup it still costs
+// a receive and usually a send per datagram, plus the event loop's poll.
+// IPv4 only, which is all the devices speak.
+class ARNativeUdpSocket : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ARNativeUdpSocket(QObject *parent = NULL);
+            ~ARNativeUdpSocket();
+
+    bool bind(const QHostAddress &address, quint16 port);
+    bool connectToHost(const QHostAddress &address, quint16 port);
+    void close();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    QHostAddress peerAddress() const;
+    quint16 peerPort() const;
+
+    // Reads as many pending datagrams as fit in a batch. Returns how many were
+    // read, 0 once the socket is drained, or -1 on error. Datagrams are valid
+    // until the next call.
+    int receive();
+    const char* datagram(int index) const;
+    int datagramSize(int index) const;
+
+    // Queues a copy of a datagram to be sent by flush(), which is called
+    // early if the batch fills up.
+    bool write(const char *data, int size);
+    bool flush();
+
+    // Socket I/O calls made and datagrams moved by them since the socket
+    // was created, for measuring batching. The event loop's polling isn't
+    // included.
+    quint64 syscallCount() const;
+    quint64 datagramCount() const;
+
+Q_SIGNALS:
+    void readyRead();
+
+private:
+    bool open();
+
+    class ARNativeUdpSocketPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(ARNativeUdpSocket)
+};
+
+#endif // ARNATIVEUDPSOCKET_H
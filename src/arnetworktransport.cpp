@@ -0,0 +1,1332 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include "arnetworktransport.h"
+
+#include "common.h"
+
+#include "arcommandcodec.h"
+#include "arcommanddictionary.h"
+#include "arcontrolconnection.h"
+
+#include <QtEndian>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#ifdef ARSDK_NATIVE_UDP
+#include "arnativeudpsocket.h"
+typedef ARNativeUdpSocket ARUdpSocket;
+#else
+#include <QUdpSocket>
+typedef QUdpSocket ARUdpSocket;
+#endif
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Non-owning view of a frame in a receive buffer, only valid while the
+// datagram it arrived in is being processed.
+struct ARControlFrame {
+    quint8      type;
+    quint8      id;
+    quint8      seq;
+    quint32     size;
+    const char *payload;
+    int         payloadSize;
+};
+
+// A frame sent on an acknowledged buffer, kept until the device
+// acknowledges it or its retries run out.
+struct ARReliableFrame
+{
+    quint8  id;
+    quint8  seq;
+
+    // Command header, for reporting delivery.
+    quint8  project;
+    quint8  klass;
+    quint16 command;
+
+    int     attempts;
+    qint64  sentAt;   // First transmission, for RTT samples.
+    qint64  deadline; // Next retransmission.
+
+    int     size;
+    char    data[ARNETWORK_MAX_DATAGRAM_SIZE];
+};
+
+// Loading state of a command project, as far as the transport knows.
+typedef enum {
+    ARProjectUnknown = 0,
+    ARProjectLoading,
+    ARProjectLoaded
+} ARProjectState;
+
+// A received command of a project that was still loading, queued once the
+// project is.
+struct ARParkedCommand
+{
+    quint8     bufferId;
+    qint64     timestamp;
+    quint32    datagram;
+    QByteArray data;
+};
+
+class ARNetworkTransportPrivate
+{
+public:
+    ARNetworkTransportPrivate(const QSharedPointer<ARCommandDictionary> &dictionary, ARTransportQueues *queues)
+        : d2c(NULL),
+          c2d(NULL),
+          commands(dictionary),
+          queues(queues),
+          filtering(true),
+          datagram(0),
+          rxTimestamp(0),
+          retransmitTimer(NULL),
+          linkTimer(NULL),
+          linkRtt(-1),
+          linkJitter(0),
+          clockOffset(0),
+          hasClockOffset(false),
+          pilotingTimer(NULL),
+          pilotingSize(0),
+          srtt(0),
+          rttvar(0),
+          frameNumber(0),
+          hiAck(0),
+          loAck(0)
+    {
+        for(int i = 0; i < 256; i++) rxSequence[i] = -1;
+        for(int i = 0; i < 256; i++) linkSequence[i] = -1;
+        std::memset(linkReceived, 0, sizeof(linkReceived));
+        std::memset(linkLost, 0, sizeof(linkLost));
+        std::memset(linkMissing, 0, sizeof(linkMissing));
+        std::memset(projects, 0, sizeof(projects));
+#ifdef ARSDK_NATIVE_UDP
+        ioSyscalls = 0;
+        ioDatagrams = 0;
+#endif
+    }
+
+    qint64 timeout(int attempts) const;
+    bool   isNewer(quint8 id, quint8 seq);
+    void   countSequence(quint8 id, quint8 seq);
+    qint64 monotonicTime() const;
+
+    // Device-to-Controller and Controller-to-Device sockets.
+    ARUdpSocket *d2c;
+    ARUdpSocket *c2d;
+
+    // Stores the current sequence ids for each frame buffer, frames from the
+    // connection are stamped as they're sent.
+    QHash<quint8, quint8> sequenceIds;
+
+    // Reusable buffer outgoing frames are encoded into.
+    QByteArray txBuffer;
+
+#ifndef ARSDK_NATIVE_UDP
+    // Datagrams are read into this, the native socket has its own batch.
+    char rxBuffer[ARNETWORK_MAX_DATAGRAM_SIZE];
+#endif
+
+    QSharedPointer<ARCommandDictionary> commands;
+    ARTransportQueues *queues;
+
+    // Projects are loaded on the thread pool when their first command
+    // arrives, the thread never waits for the dictionary.
+    quint8                          projects[256]; // ARProjectState
+    QHash<QObject*, quint8>         projectLoads;  // Future watchers, by project.
+    QList<ARParkedCommand>          parked;
+
+    // Copies of the controller's interest bitmaps.
+    bool      filtering;
+    QBitArray interest;
+    QBitArray everySample;
+
+    // Last sequence id delivered per receive buffer, -1 before the first.
+    int rxSequence[256];
+
+    // Link monitoring. Pings are sent every ARNETWORK_LINK_INTERVAL_MS, RTT
+    // and jitter are smoothed over their pongs, and the clock offset over the
+    // device's pings. Sequence gaps are counted per buffer over an interval.
+    QTimer *linkTimer;
+    qint64  linkRtt;
+    qint64  linkJitter;
+    qint64  clockOffset;
+    bool    hasClockOffset;
+    int     linkSequence[256];
+    quint32 linkReceived[256];
+    quint32 linkLost[256];
+    quint32 linkMissing[256]; // Bit n set if the frame n before the last is missing.
+
+#ifdef ARSDK_NATIVE_UDP
+    // Socket syscall and datagram counts at the last link update.
+    quint64 ioSyscalls;
+    quint64 ioDatagrams;
+#endif
+
+    // Last state payload seen per command key, to skip repeats.
+    QHash<quint32, QByteArray> lastPayloads;
+
+    // Receive timestamps, relative to when the transport was created.
+    QElapsedTimer clock;
+    quint32 datagram;
+    qint64  rxTimestamp;
+
+    // Unacknowledged frames, at most ARNETWORK_RELIABLE_WINDOW of them.
+    QVector<ARReliableFrame> inFlight;
+    QTimer *retransmitTimer;
+
+    // Piloting command frame, re-sent with the latest values on every tick.
+    QTimer *pilotingTimer;
+    char    pilotingFrame[ARNETWORK_MAX_DATAGRAM_SIZE];
+    int     pilotingSize;
+    int     pilotingOffsets[5]; // Flag, roll, pitch, yaw and gaz, -1 if absent.
+
+    // Smoothed round trip time and its variation in nanoseconds, zero until
+    // the first sample (RFC 6298).
+    qint64 srtt;
+    qint64 rttvar;
+
+    // TODO: Refactor out into FrameDataProcessor? (This is deprecated, StreamV2 ftw)
+    // Video streaming data
+    quint16 frameNumber;
+    quint64 hiAck;
+    quint64 loAck;
+};
+
+// Whether a frame comes after the last one delivered on its buffer, in which
+// case it becomes the last. Sequence ids wrap, so they're compared by their
+// signed difference. A jump further back than the window is taken as the
+// device starting over rather than as a stale frame.
+bool ARNetworkTransportPrivate::isNewer(quint8 id, quint8 seq)
+{
+    int last = rxSequence[id];
+    qint8 delta = static_cast<qint8>(seq - last);
+
+    if(last >= 0 && delta <= 0 && delta > -ARNETWORK_SEQUENCE_WINDOW) return false;
+
+    rxSequence[id] = seq;
+    return true;
+}
+
+// Loss is counted from gaps. A frame that turns up late is moved from lost to
+// received if it fills a gap, duplicates aren't counted at all.
+void ARNetworkTransportPrivate::countSequence(quint8 id, quint8 seq)
+{
+    int last = linkSequence[id];
+    qint8 delta = static_cast<qint8>(seq - last);
+
+    if(last < 0 || delta <= -ARNETWORK_SEQUENCE_WINDOW)
+    {
+        linkReceived[id]++;
+        linkSequence[id] = seq;
+        linkMissing[id] = 0;
+    }
+    else if(delta > 0)
+    {
+        // Frames between the last and this one are missing, for now.
+        quint32 gap = delta > 32 ? 0xfffffffe : ((quint32(1) << (delta - 1)) - 1) << 1;
+        quint32 missing = delta >= 32 ? 0 : linkMissing[id] << delta;
+
+        linkReceived[id]++;
+        linkLost[id] += delta - 1;
+        linkSequence[id] = seq;
+        linkMissing[id] = missing | gap;
+    }
+    else if(delta < 0 && linkMissing[id] & (quint32(1) << -delta))
+    {
+        // The gap was counted as lost, possibly in an earlier interval.
+        linkMissing[id] &= ~(quint32(1) << -delta);
+        linkReceived[id]++;
+        if(linkLost[id] > 0) linkLost[id]--;
+    }
+}
+
+// Nanoseconds on the system's monotonic clock, the device's ping timestamps
+// are compared against it.
+qint64 ARNetworkTransportPrivate::monotonicTime() const
+{
+    return clock.msecsSinceReference() * 1000000 + clock.nsecsElapsed();
+}
+
+// Retransmission timeout from the measured RTT, doubled for each attempt
+// that went unacknowledged.
+qint64 ARNetworkTransportPrivate::timeout(int attempts) const
+{
+    const qint64 ms = 1000000;
+
+    qint64 rto = srtt > 0 ? srtt + qMax(ms, 4 * rttvar) : ARNETWORK_INITIAL_RTO_MS * ms;
+    rto = qBound(ARNETWORK_MIN_RTO_MS * ms, rto, ARNETWORK_MAX_RTO_MS * ms);
+
+    for(int i = 1; i < attempts && rto < ARNETWORK_MAX_RTO_MS * ms; i++) rto *= 2;
+    return qMin(rto, ARNETWORK_MAX_RTO_MS * ms);
+}
+
+ARNetworkTransport::ARNetworkTransport(const QSharedPointer<ARCommandDictionary> &dictionary, ARTransportQueues *queues)
+    : QObject(NULL), d_ptr(new ARNetworkTransportPrivate(dictionary, queues))
+{
+    Q_D(ARNetworkTransport);
+
+    // Reserved capacity is kept across resize(0), so steady state sends don't allocate.
+    d->txBuffer.reserve(ARNETWORK_MAX_DATAGRAM_SIZE);
+    d->inFlight.reserve(ARNETWORK_RELIABLE_WINDOW);
+
+    d->retransmitTimer = new QTimer(this);
+    d->retransmitTimer->setSingleShot(true);
+    d->retransmitTimer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(d->retransmitTimer, SIGNAL(timeout()), this, SLOT(onRetransmitTimeout()));
+
+    d->pilotingTimer = new QTimer(this);
+    d->pilotingTimer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(d->pilotingTimer, SIGNAL(timeout()), this, SLOT(onPilotingTimeout()));
+
+    d->linkTimer = new QTimer(this);
+    QObject::connect(d->linkTimer, SIGNAL(timeout()), this, SLOT(onLinkTimeout()));
+
+    d->clock.start();
+}
+
+ARNetworkTransport::~ARNetworkTransport()
+{
+    close();
+    delete d_ptr;
+}
+
+void ARNetworkTransport::open(const QString &localAddress, quint16 localPort, const QString &deviceAddress, quint16 devicePort)
+{
+    TRACE
+    Q_D(ARNetworkTransport);
+
+    DEBUG_T("Creating D2C UDP communications socket...");
+    // Setup UDP port for D2C comms.
+    d->d2c = new ARUdpSocket(this);
+    if(!d->d2c->bind(QHostAddress(localAddress), localPort))
+    {
+        emit error(d->d2c->errorString());
+    }
+
+    QObject::connect(d->d2c, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+
+    DEBUG_T("Creating C2D UDP communications socket...");
+    // Setup UDP port for C2D comms.
+    d->c2d = new ARUdpSocket(this);
+#ifdef ARSDK_NATIVE_UDP
+    // Unlike QUdpSocket, the native socket doesn't look up host names.
+    QHostAddress device;
+    if(!device.setAddress(deviceAddress))
+    {
+        emit error(QString("Invalid device address: %1").arg(deviceAddress));
+    }
+    else if(!d->c2d->connectToHost(device, devicePort))
+    {
+        emit error(d->c2d->errorString());
+    }
+#else
+    d->c2d->connectToHost(deviceAddress, devicePort);
+#endif
+
+    // Anything queued before the sockets existed.
+    flush();
+
+    d->linkTimer->start(ARNETWORK_LINK_INTERVAL_MS);
+}
+
+void ARNetworkTransport::close()
+{
+    TRACE
+    Q_D(ARNetworkTransport);
+
+    d->retransmitTimer->stop();
+    d->inFlight.clear();
+
+    d->pilotingTimer->stop();
+    d->linkTimer->stop();
+
+    if(d->c2d != NULL)
+    {
+        d->c2d->close();
+        delete d->c2d;
+        d->c2d = NULL;
+    }
+
+    if(d->d2c != NULL)
+    {
+        d->d2c->close();
+        delete d->d2c;
+        d->d2c = NULL;
+    }
+
+#ifdef ARSDK_NATIVE_UDP
+    d->ioSyscalls = 0;
+    d->ioDatagrams = 0;
+#endif
+}
+
+void ARNetworkTransport::flush()
+{
+    Q_D(ARNetworkTransport);
+
+    // Cleared first, so datagrams queued while draining signal again.
+    d->queues->outgoingSignalled.storeRelease(0);
+
+    if(d->c2d == NULL) return;
+
+    sendEmergency();
+
+    while(AROutgoingDatagram *datagram = d->queues->outgoing.front())
+    {
+        // Emergencies queued meanwhile go before the rest of the burst.
+        sendEmergency();
+
+        stampSequenceIds(datagram->data, datagram->size);
+        trackReliable(datagram->data, datagram->size);
+        sendDatagram(datagram->data, datagram->size);
+        d->queues->outgoing.pop();
+    }
+
+    scheduleRetransmit();
+
+#ifdef ARSDK_NATIVE_UDP
+    d->c2d->flush();
+#endif
+}
+
+void ARNetworkTransport::setInterest(const QBitArray &interest, const QBitArray &everySample)
+{
+    Q_D(ARNetworkTransport);
+    d->interest = interest;
+    d->everySample = everySample;
+
+    // Payloads of commands nobody listened to weren't tracked, forget them all
+    // so a new listener gets the next state even if it didn't change.
+    d->lastPayloads.clear();
+}
+
+void ARNetworkTransport::setFiltering(bool enabled)
+{
+    Q_D(ARNetworkTransport);
+    d->filtering = enabled;
+}
+
+void ARNetworkTransport::startPiloting(int project, int klass, int command, int interval)
+{
+    Q_D(ARNetworkTransport);
+
+    ARCommandInfo *info = d->commands->find(project, klass, command);
+    if(info == NULL)
+    {
+        emit error("Unable to resolve piloting command");
+        return;
+    }
+
+    // Encoded once with every argument zero, ticks only patch the values in.
+    d->txBuffer.resize(0);
+    int start = ARCommandCodec::beginFrame(d->txBuffer, ARControlConnection::Data, info->bufferId, 0x00);
+    d->txBuffer.append(static_cast<char>(info->klass->project));
+    d->txBuffer.append(static_cast<char>(info->klass->id));
+    d->txBuffer.append(static_cast<char>(info->id & 0xff));
+    d->txBuffer.append(static_cast<char>(info->id >> 8));
+
+    // Argument names by slot (flag, roll, pitch, yaw, gaz). Ground vehicles
+    // such as the Jumping Sumo drive with speed and turn, taken from pitch
+    // and yaw.
+    static const struct { const char *name; int slot; } names[] = {
+        { "flag", 0 }, { "roll", 1 }, { "pitch", 2 }, { "speed", 2 }, { "yaw", 3 }, { "turn", 3 }, { "gaz", 4 }
+    };
+    for(int i = 0; i < 5; i++) d->pilotingOffsets[i] = -1;
+
+    for(int i = 0; i < info->arguments.size(); i++)
+    {
+        const ARCommandArgumentInfo *argument = info->arguments.at(i);
+        if(argument->size == 0)
+        {
+            emit error("Piloting command has variable length arguments");
+            return;
+        }
+
+        for(size_t j = 0; j < sizeof(names) / sizeof(names[0]); j++)
+        {
+            if(argument->size == 1 && *argument->name == QLatin1String(names[j].name))
+            {
+                d->pilotingOffsets[names[j].slot] = ARNETWORK_FRAME_HEADER_SIZE + ARNETWORK_COMMAND_HEADER_SIZE + argument->offset;
+            }
+        }
+
+        d->txBuffer.append(QByteArray(argument->size, 0x00));
+    }
+
+    // Sending nothing but zeroes would look like working piloting.
+    if(d->pilotingOffsets[1] < 0 && d->pilotingOffsets[2] < 0 && d->pilotingOffsets[3] < 0 && d->pilotingOffsets[4] < 0)
+    {
+        emit error(QString("Piloting command %1 has no known axes").arg(*info->name));
+        return;
+    }
+
+    ARCommandCodec::endFrame(d->txBuffer, start);
+
+    d->pilotingSize = d->txBuffer.size();
+    std::memcpy(d->pilotingFrame, d->txBuffer.constData(), d->pilotingSize);
+
+    // A timer that fell behind skips the ticks it missed rather than
+    // catching up with a burst.
+    d->pilotingTimer->start(interval);
+}
+
+void ARNetworkTransport::stopPiloting()
+{
+    Q_D(ARNetworkTransport);
+    d->pilotingTimer->stop();
+}
+
+void ARNetworkTransport::onPilotingTimeout()
+{
+    Q_D(ARNetworkTransport);
+
+    sendEmergency();
+
+    quint64 state = d->queues->piloting.values.loadAcquire();
+    qint8 values[5] = {
+        static_cast<qint8>((state >> 32) & 0x01),
+        static_cast<qint8>(state & 0xff),
+        static_cast<qint8>((state >> 8) & 0xff),
+        static_cast<qint8>((state >> 16) & 0xff),
+        static_cast<qint8>((state >> 24) & 0xff)
+    };
+
+    for(int i = 0; i < 5; i++)
+    {
+        if(d->pilotingOffsets[i] >= 0) d->pilotingFrame[d->pilotingOffsets[i]] = values[i];
+    }
+
+    stampSequenceIds(d->pilotingFrame, d->pilotingSize);
+    sendDatagram(d->pilotingFrame, d->pilotingSize);
+
+#ifdef ARSDK_NATIVE_UDP
+    if(d->c2d != NULL) d->c2d->flush();
+#endif
+}
+
+void ARNetworkTransport::setRealtime(bool enabled)
+{
+#ifdef Q_OS_UNIX
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = enabled ? ARNETWORK_REALTIME_PRIORITY : 0;
+
+    int result = pthread_setschedparam(pthread_self(), enabled ? SCHED_FIFO : SCHED_OTHER, &param);
+    if(result != 0)
+    {
+        WARNING_T(QString("Failed to set network thread scheduling: %1").arg(std::strerror(result)));
+    }
+#else
+    QThread::currentThread()->setPriority(enabled ? QThread::TimeCriticalPriority : QThread::NormalPriority);
+#endif
+}
+
+void ARNetworkTransport::setCpuAffinity(int cpu)
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    if(cpu < 0)
+    {
+        for(int i = 0; i < CPU_SETSIZE; i++) CPU_SET(i, &cpus);
+    }
+    else
+    {
+        CPU_SET(cpu, &cpus);
+    }
+
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if(result != 0)
+    {
+        WARNING_T(QString("Failed to set network thread affinity: %1").arg(std::strerror(result)));
+    }
+#else
+    if(cpu >= 0) WARNING_T("Network thread affinity is only supported on Linux.");
+#endif
+}
+
+bool ARNetworkTransport::sendDatagram(const char *data, int size)
+{
+    Q_D(ARNetworkTransport);
+
+#ifdef ARSDK_NATIVE_UDP
+    // Queued, and sent with everything else at the end of the burst.
+    if(d->c2d == NULL || !d->c2d->isOpen())
+    {
+        emit error("Control connection not establised.");
+        return false;
+    }
+
+    if(!d->c2d->write(data, size))
+    {
+        WARNING_T(QString("Failed to send message: %1").arg(d->c2d->errorString()));
+        return false;
+    }
+#else
+    // Check we're actually able to send.
+    if(d->c2d == NULL || !d->c2d->isWritable())
+    {
+        emit error("Control connection not establised.");
+        return false;
+    }
+
+    qint64 result = d->c2d->write(data, size);
+    if(result != size)
+    {
+        //TODO: Maybe retry here ..
+        WARNING_T("Failed to send complete message");
+        return false;
+    }
+#endif
+
+    if(static_cast<quint8>(data[0]) != ARControlConnection::LowLatencyData)
+    {
+        DEBUG_T(QString(">> %1:%2 [%3]")
+                .arg(d->c2d->peerAddress().toString())
+                .arg(d->c2d->peerPort())
+                .arg(QString(QByteArray(data, size).toHex())));
+    }
+
+    return true;
+}
+
+bool ARNetworkTransport::sendFrame(quint8 type, quint8 id, quint8 seq, const char *data, quint32 dataSize)
+{
+    Q_D(ARNetworkTransport);
+
+    d->txBuffer.resize(0);
+
+    int start = ARCommandCodec::beginFrame(d->txBuffer, type, id, seq);
+    if(dataSize > 0) d->txBuffer.append(data, dataSize);
+    ARCommandCodec::endFrame(d->txBuffer, start);
+
+    return sendDatagram(d->txBuffer.constData(), d->txBuffer.size());
+}
+
+bool ARNetworkTransport::sendFrame(quint8 type, quint8 id, const char *data, quint32 dataSize)
+{
+    Q_D(ARNetworkTransport);
+
+    quint8 seq = d->sequenceIds.value(id, 0x00);
+
+    if(!sendFrame(type, id, seq, data, dataSize)) return false;
+
+    d->sequenceIds.insert(id, seq + 1);
+    return true;
+}
+
+// Commands loaded since the bitmaps were built are queued, and matched
+// against listeners when delivered.
+bool ARNetworkTransport::isInterested(const ARCommandInfo *command) const
+{
+    Q_D(const ARNetworkTransport);
+
+    if(command->index >= d->interest.size()) return true;
+    return command->index >= 0 && d->interest.testBit(command->index);
+}
+
+bool ARNetworkTransport::wantsEverySample(const ARCommandInfo *command) const
+{
+    Q_D(const ARNetworkTransport);
+
+    if(command->index >= d->everySample.size()) return true;
+    return command->index >= 0 && d->everySample.testBit(command->index);
+}
+
+void ARNetworkTransport::onReadyRead()
+{
+    Q_D(ARNetworkTransport);
+
+#ifdef ARSDK_NATIVE_UDP
+    // A full batch may mean there's more waiting.
+    int count;
+    do
+    {
+        count = d->d2c->receive();
+        for(int i = 0; i < count; i++)
+        {
+            processDatagram(d->d2c->datagram(i), d->d2c->datagramSize(i));
+        }
+    }
+    while(count == ARNETWORK_BATCH_SIZE);
+
+    if(count < 0) WARNING_T(QString("Failed to receive: %1").arg(d->d2c->errorString()));
+
+    // Acknowledges and pongs for the whole burst go out together.
+    d->c2d->flush();
+#else
+    while(d->d2c->hasPendingDatagrams())
+    {
+        // Anything larger is truncated by the read, so drop it.
+        bool oversized = d->d2c->pendingDatagramSize() > ARNETWORK_MAX_DATAGRAM_SIZE;
+
+        qint64 size = d->d2c->readDatagram(d->rxBuffer, sizeof(d->rxBuffer));
+        if(size < 0) break;
+
+        if(oversized)
+        {
+            WARNING_T("Dropping oversized datagram");
+            continue;
+        }
+
+        processDatagram(d->rxBuffer, size);
+    }
+#endif
+
+    if(d->queues->receivedSignalled.testAndSetOrdered(0, 1)) emit received();
+}
+
+void ARNetworkTransport::processDatagram(const char *data, int size)
+{
+    Q_D(ARNetworkTransport);
+
+    // Replies to this datagram can wait behind an emergency.
+    sendEmergency();
+
+    // Too short to hold a frame, drop it.
+    if(size < ARNETWORK_FRAME_HEADER_SIZE) return;
+
+    d->rxTimestamp = d->clock.nsecsElapsed();
+    d->datagram++;
+
+    // Output comms debug info (if it's not video data).
+    if(static_cast<quint8>(data[1]) != ARNET_D2C_VIDEO_DATA_ID)
+    {
+        DEBUG_T(QString("<< [%1]").arg(QString(QByteArray(data, size).toHex())));
+    }
+
+    // Frames are handled in place, nothing they point to outlives this call.
+    int offset = 0;
+    while(size - offset >= ARNETWORK_FRAME_HEADER_SIZE)
+    {
+        ARControlFrame frame;
+        frame.type = static_cast<quint8>(data[offset + 0]);
+        frame.id = static_cast<quint8>(data[offset + 1]);
+        frame.seq = static_cast<quint8>(data[offset + 2]);
+        frame.size = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(data + offset + 3));
+
+        // A frame shorter than its header would never advance the offset.
+        if(frame.size < ARNETWORK_FRAME_HEADER_SIZE || frame.size > quint32(size - offset))
+        {
+            WARNING_T(QString("Malformed frame size: %1").arg(frame.size));
+            break;
+        }
+
+        frame.payload = data + offset + ARNETWORK_FRAME_HEADER_SIZE;
+        frame.payloadSize = frame.size - ARNETWORK_FRAME_HEADER_SIZE;
+
+        if(frame.type != ARControlConnection::Acknowledge) d->countSequence(frame.id, frame.seq);
+
+        // Process frame depending on buffer id.
+        if(frame.type == ARControlConnection::Acknowledge)
+        {
+            onAcknowledge(frame);
+        }
+        else if(frame.id == ARNET_D2C_PING_ID)
+        {
+            onPing(frame);
+        }
+        else if(frame.id == ARNET_D2C_PONG_ID)
+        {
+            onPong(frame);
+        }
+        else if(frame.id == ARNET_D2C_EVENT_ID || frame.id == ARNET_D2C_NAVDATA_ID)
+        {
+            onNavdata(frame);
+        }
+        else if(frame.id == ARNET_D2C_VIDEO_DATA_ID)
+        {
+            onVideoData(frame);
+        }
+        else
+        {
+            WARNING_T(QString("Unhandled frame id: %1").arg(frame.id));
+        }
+
+        // Increment datagram offset to continue processing next frame.
+        offset += frame.size;
+    }
+
+    // The consumer only ever sees whole datagrams.
+    d->queues->received.commit();
+}
+
+void ARNetworkTransport::sendEmergency()
+{
+    Q_D(ARNetworkTransport);
+
+    if(d->c2d == NULL) return;
+
+    while(AROutgoingDatagram *datagram = d->queues->emergency.front())
+    {
+        stampSequenceIds(datagram->data, datagram->size);
+        trackReliable(datagram->data, datagram->size);
+        sendDatagram(datagram->data, datagram->size);
+
+#ifdef ARSDK_NATIVE_UDP
+        // Not held back for the rest of the batch.
+        d->c2d->flush();
+#endif
+
+        emit emergencySent(d->queues->clock.nsecsElapsed() - datagram->queuedAt);
+        d->queues->emergency.pop();
+
+        scheduleRetransmit();
+    }
+}
+
+void ARNetworkTransport::stampSequenceIds(char *data, int size)
+{
+    Q_D(ARNetworkTransport);
+
+    int offset = 0;
+    while(size - offset >= ARNETWORK_FRAME_HEADER_SIZE)
+    {
+        char *frame = data + offset;
+        quint32 frameSize = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(frame + 3));
+        if(frameSize < ARNETWORK_FRAME_HEADER_SIZE || frameSize > quint32(size - offset)) break;
+
+        quint8 id  = static_cast<quint8>(frame[1]);
+        quint8 seq = d->sequenceIds.value(id, 0x00);
+        frame[2] = static_cast<char>(seq);
+        d->sequenceIds.insert(id, seq + 1);
+
+        offset += frameSize;
+    }
+}
+
+void ARNetworkTransport::trackReliable(const char *data, int size)
+{
+    Q_D(ARNetworkTransport);
+
+    qint64 now = d->clock.nsecsElapsed();
+
+    // Datagrams are validated frames written by the connection.
+    int offset = 0;
+    while(size - offset >= ARNETWORK_FRAME_HEADER_SIZE)
+    {
+        const char *frame = data + offset;
+        quint32 frameSize = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(frame + 3));
+        if(frameSize < ARNETWORK_FRAME_HEADER_SIZE || frameSize > quint32(size - offset)) break;
+
+        offset += frameSize;
+
+        if(static_cast<quint8>(frame[0]) != ARControlConnection::AcknowledgeData) continue;
+
+        quint8 id  = static_cast<quint8>(frame[1]);
+        quint8 seq = static_cast<quint8>(frame[2]);
+
+        // A sequence id that wrapped round replaces the frame it was last used for.
+        int index = 0;
+        while(index < d->inFlight.size() && (d->inFlight.at(index).id != id || d->inFlight.at(index).seq != seq)) index++;
+
+        if(index == d->inFlight.size())
+        {
+            if(index == ARNETWORK_RELIABLE_WINDOW)
+            {
+                WARNING_T(QString("Too many unacknowledged frames, not tracking %1:%2").arg(id).arg(seq));
+                continue;
+            }
+            d->inFlight.resize(index + 1);
+        }
+
+        ARReliableFrame &entry = d->inFlight[index];
+        entry.id = id;
+        entry.seq = seq;
+
+        if(frameSize >= ARNETWORK_FRAME_HEADER_SIZE + ARNETWORK_COMMAND_HEADER_SIZE)
+        {
+            const char *header = frame + ARNETWORK_FRAME_HEADER_SIZE;
+            entry.project = static_cast<quint8>(header[0]);
+            entry.klass = static_cast<quint8>(header[1]);
+            entry.command = qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(header + 2));
+        }
+        else
+        {
+            entry.project = entry.klass = 0;
+            entry.command = 0;
+        }
+
+        entry.attempts = 1;
+        entry.sentAt = now;
+        entry.deadline = now + d->timeout(1);
+        entry.size = frameSize;
+        std::memcpy(entry.data, frame, frameSize);
+    }
+}
+
+void ARNetworkTransport::scheduleRetransmit()
+{
+    Q_D(ARNetworkTransport);
+
+    if(d->inFlight.isEmpty())
+    {
+        d->retransmitTimer->stop();
+        return;
+    }
+
+    qint64 deadline = d->inFlight.at(0).deadline;
+    for(int i = 1; i < d->inFlight.size(); i++) deadline = qMin(deadline, d->inFlight.at(i).deadline);
+
+    qint64 remaining = deadline - d->clock.nsecsElapsed();
+    d->retransmitTimer->start(remaining > 0 ? int((remaining + 999999) / 1000000) : 0);
+}
+
+void ARNetworkTransport::onAcknowledge(const ARControlFrame &frame)
+{
+    Q_D(ARNetworkTransport);
+
+    if(frame.id < ARNET_ACK_ID_OFFSET || frame.payloadSize < 1)
+    {
+        WARNING_T(QString("Malformed acknowledge on buffer %1").arg(frame.id));
+        return;
+    }
+
+    quint8 id  = frame.id - ARNET_ACK_ID_OFFSET;
+    quint8 seq = static_cast<quint8>(frame.payload[0]);
+
+    for(int i = 0; i < d->inFlight.size(); i++)
+    {
+        const ARReliableFrame &entry = d->inFlight.at(i);
+        if(entry.id != id || entry.seq != seq) continue;
+
+        // Only frames sent once give an unambiguous sample (Karn's algorithm).
+        if(entry.attempts == 1)
+        {
+            qint64 rtt = d->rxTimestamp - entry.sentAt;
+            if(d->srtt == 0)
+            {
+                d->srtt = rtt;
+                d->rttvar = rtt / 2;
+            }
+            else
+            {
+                d->rttvar = (3 * d->rttvar + qAbs(d->srtt - rtt)) / 4;
+                d->srtt = (7 * d->srtt + rtt) / 8;
+            }
+        }
+
+        emit delivered(entry.project, entry.klass, entry.command);
+
+        d->inFlight.remove(i);
+        scheduleRetransmit();
+        return;
+    }
+
+    // Acknowledges of retransmitted frames can arrive more than once.
+    DEBUG_T(QString("Unmatched acknowledge %1:%2").arg(id).arg(seq));
+}
+
+void ARNetworkTransport::onRetransmitTimeout()
+{
+    Q_D(ARNetworkTransport);
+
+    sendEmergency();
+
+    qint64 now = d->clock.nsecsElapsed();
+
+    int i = 0;
+    while(i < d->inFlight.size())
+    {
+        ARReliableFrame &entry = d->inFlight[i];
+        if(entry.deadline > now)
+        {
+            i++;
+            continue;
+        }
+
+        if(entry.attempts > ARNETWORK_RELIABLE_RETRIES)
+        {
+            WARNING_T(QString("Frame %1:%2 was never acknowledged").arg(entry.id).arg(entry.seq));
+            emit deliveryFailed(entry.project, entry.klass, entry.command);
+            d->inFlight.remove(i);
+            continue;
+        }
+
+        entry.attempts++;
+        entry.deadline = now + d->timeout(entry.attempts);
+        sendDatagram(entry.data, entry.size);
+        i++;
+    }
+
+#ifdef ARSDK_NATIVE_UDP
+    if(d->c2d != NULL) d->c2d->flush();
+#endif
+
+    scheduleRetransmit();
+}
+
+// The device's pings carry its clock as a timespec, 32 or 64 bit depending
+// on the device. Half an RTT before it arrived is when it was sent.
+void ARNetworkTransport::onPing(const ARControlFrame &frame)
+{
+    Q_D(ARNetworkTransport);
+
+    sendFrame(frame.type,
+              (quint8)ARNET_C2D_PONG_ID,
+              frame.seq,
+              frame.payload,
+              frame.payloadSize);
+
+    const uchar *payload = reinterpret_cast<const uchar*>(frame.payload);
+    qint64 deviceTime;
+    if(frame.payloadSize == 8)
+    {
+        deviceTime = qint64(qFromLittleEndian<qint32>(payload)) * 1000000000
+                   + qFromLittleEndian<qint32>(payload + 4);
+    }
+    else if(frame.payloadSize == 16)
+    {
+        deviceTime = qFromLittleEndian<qint64>(payload) * 1000000000
+                   + qFromLittleEndian<qint64>(payload + 8);
+    }
+    else
+    {
+        return;
+    }
+
+    qint64 sentAt = d->monotonicTime() - (d->clock.nsecsElapsed() - d->rxTimestamp);
+    if(d->linkRtt > 0) sentAt -= d->linkRtt / 2;
+
+    qint64 offset = deviceTime - sentAt;
+    d->clockOffset = d->hasClockOffset ? d->clockOffset + (offset - d->clockOffset) / 8 : offset;
+    d->hasClockOffset = true;
+}
+
+// Our pings carry the transport's clock, which the device echoes back.
+void ARNetworkTransport::onPong(const ARControlFrame &frame)
+{
+    Q_D(ARNetworkTransport);
+
+    if(frame.payloadSize != sizeof(qint64)) return;
+
+    qint64 rtt = d->rxTimestamp - qFromLittleEndian<qint64>(reinterpret_cast<const uchar*>(frame.payload));
+    if(rtt < 0) return;
+
+    // Smoothed as for retransmissions, jitter as in RFC 3550.
+    if(d->linkRtt < 0)
+    {
+        d->linkRtt = rtt;
+    }
+    else
+    {
+        d->linkJitter += (qAbs(rtt - d->linkRtt) - d->linkJitter) / 16;
+        d->linkRtt += (rtt - d->linkRtt) / 8;
+    }
+}
+
+void ARNetworkTransport::onLinkTimeout()
+{
+    Q_D(ARNetworkTransport);
+
+    sendEmergency();
+
+    uchar ping[sizeof(qint64)];
+    qToLittleEndian<qint64>(d->clock.nsecsElapsed(), ping);
+    sendFrame(ARControlConnection::Data, ARNET_C2D_PING_ID, reinterpret_cast<const char*>(ping), sizeof(ping));
+
+#ifdef ARSDK_NATIVE_UDP
+    if(d->c2d != NULL) d->c2d->flush();
+
+    if(d->d2c != NULL && d->c2d != NULL)
+    {
+        quint64 syscalls = d->d2c->syscallCount() + d->c2d->syscallCount();
+        quint64 datagrams = d->d2c->datagramCount() + d->c2d->datagramCount();
+
+        if(datagrams > d->ioDatagrams)
+        {
+            DEBUG_T(QString("Socket syscalls per datagram: %1")
+                    .arg(double(syscalls - d->ioSyscalls) / (datagrams - d->ioDatagrams), 0, 'f', 2));
+        }
+
+        d->ioSyscalls = syscalls;
+        d->ioDatagrams = datagrams;
+    }
+#endif
+
+    QVariantMap lossRates;
+    quint32 received = 0;
+    quint32 lost = 0;
+
+    for(int id = 0; id < 256; id++)
+    {
+        quint32 expected = d->linkReceived[id] + d->linkLost[id];
+        if(expected == 0) continue;
+
+        lossRates.insert(QString::number(id), double(d->linkLost[id]) / expected);
+        received += d->linkReceived[id];
+        lost += d->linkLost[id];
+    }
+
+    std::memset(d->linkReceived, 0, sizeof(d->linkReceived));
+    std::memset(d->linkLost, 0, sizeof(d->linkLost));
+
+    const double ms = 1000000.0;
+    emit linkQuality(d->linkRtt < 0 ? -1 : d->linkRtt / ms,
+                     d->linkRtt < 0 ? -1 : d->linkJitter / ms,
+                     d->clockOffset / ms,
+                     received + lost > 0 ? double(lost) / (received + lost) : 0,
+                     lossRates);
+}
+
+void ARNetworkTransport::onNavdata(const ARControlFrame &frame)
+{
+    Q_D(ARNetworkTransport);
+
+    // TODO: Should we do this, or should we allow application to decide
+    // when/if an acknowledge occurs?
+    // Construct acknowledge frame, if this incoming frame requires it.
+    if(frame.type == ARControlConnection::AcknowledgeData)
+    {
+        char payload = static_cast<char>(frame.seq);
+        sendFrame(ARControlConnection::Acknowledge, ARNET_C2D_NAVDATA_ACK_ID, &payload, sizeof(payload));
+    }
+
+    // Duplicates, such as events resent because our acknowledge was lost, are
+    // only acknowledged again. Samples older than the last are dropped.
+    if(!d->isNewer(frame.id, frame.seq))
+    {
+        DEBUG_T(QString("Dropping stale frame %1:%2").arg(frame.id).arg(frame.seq));
+        return;
+    }
+
+    receiveCommand(frame.id, frame.payload, frame.payloadSize, d->rxTimestamp, d->datagram);
+}
+
+void ARNetworkTransport::receiveCommand(quint8 bufferId, const char *data, int size, qint64 timestamp, quint32 datagram)
+{
+    Q_D(ARNetworkTransport);
+
+    if(size < ARNETWORK_COMMAND_HEADER_SIZE)
+    {
+        WARNING_T("Navdata frame too short for command header");
+        return;
+    }
+
+    // Decode command header.
+    const char *header = data;
+    quint8  project  = static_cast<quint8>(header[0]);
+    quint8  klass    = static_cast<quint8>(header[1]);
+    quint16 id       = qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(header + 2));
+
+    // Resolve command meta-type information, never waiting for a project to
+    // load on this thread.
+    ARCommandInfo *command = d->commands->find(project, klass, id);
+    if(command == NULL && d->projects[project] != ARProjectLoaded)
+    {
+        if(d->projects[project] == ARProjectUnknown)
+        {
+            DEBUG_T(QString("Loading command project %1").arg(project));
+            d->projects[project] = ARProjectLoading;
+
+            QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+            QObject::connect(watcher, SIGNAL(finished()), this, SLOT(onProjectLoaded()));
+            d->projectLoads.insert(watcher, project);
+            watcher->setFuture(d->commands->loadProjectsAsync(QList<quint8>() << project));
+        }
+
+        if(d->parked.size() >= ARNETWORK_MAX_PARKED_FRAMES)
+        {
+            WARNING_T(QString("Dropping command of project %1, still loading").arg(project));
+            return;
+        }
+
+        ARParkedCommand parked;
+        parked.bufferId = bufferId;
+        parked.timestamp = timestamp;
+        parked.datagram = datagram;
+        parked.data = QByteArray(data, size);
+        d->parked.append(parked);
+        return;
+    }
+
+    if(command == NULL)
+    {
+        WARNING_T(QString("Unrecognised command: %1 %2 %3")
+                  .arg(project)
+                  .arg(klass)
+                  .arg(id));
+        return;
+    }
+
+    // Nobody is interested in this command, don't bother queueing it.
+    if(d->filtering && !isInterested(command))
+    {
+        return;
+    }
+
+    const char *payload = header + ARNETWORK_COMMAND_HEADER_SIZE;
+    int         payloadSize = size - ARNETWORK_COMMAND_HEADER_SIZE;
+
+    // The device resends many states and state events (battery, settings)
+    // with identical payloads, each with a fresh sequence id. Skip those
+    // unless somebody wants every sample, events were acknowledged already.
+    if(bufferId == ARNET_D2C_NAVDATA_ID || bufferId == ARNET_D2C_EVENT_ID)
+    {
+        QByteArray &last = d->lastPayloads[command->key()];
+        if(last.size() == payloadSize && std::memcmp(last.constData(), payload, payloadSize) == 0)
+        {
+            if(!wantsEverySample(command)) return;
+        }
+        else
+        {
+            // Storage is kept once a key is seen, so this doesn't allocate in
+            // steady state.
+            last.resize(payloadSize);
+            std::memcpy(last.data(), payload, payloadSize);
+        }
+    }
+
+    if(payloadSize > int(sizeof(ARReceivedCommand::payload)))
+    {
+        WARNING_T(QString("Dropping command %1, payload too large").arg(*command->name));
+        return;
+    }
+
+    ARReceivedCommand *entry = d->queues->received.push();
+    if(entry == NULL)
+    {
+        WARNING_T(QString("Dropping command %1, receive queue full").arg(*command->name));
+        return;
+    }
+
+    entry->command = command;
+    entry->timestamp = timestamp;
+    entry->datagram = datagram;
+    entry->size = payloadSize;
+    std::memcpy(entry->payload, payload, payloadSize);
+}
+
+// Whether or not the project loaded, its parked commands are queued now, or
+// dropped as unrecognised.
+void ARNetworkTransport::onProjectLoaded()
+{
+    Q_D(ARNetworkTransport);
+
+    QObject *watcher = sender();
+    if(!d->projectLoads.contains(watcher)) return;
+
+    quint8 project = d->projectLoads.take(watcher);
+    d->projects[project] = ARProjectLoaded;
+    watcher->deleteLater();
+
+    QList<ARParkedCommand> parked;
+    parked.swap(d->parked);
+
+    foreach(const ARParkedCommand &command, parked)
+    {
+        if(static_cast<quint8>(command.data.at(0)) == project)
+        {
+            receiveCommand(command.bufferId, command.data.constData(), command.data.size(), command.timestamp, command.datagram);
+        }
+        else
+        {
+            d->parked.append(command);
+        }
+    }
+
+    // Queued outside of any datagram, so published here.
+    d->queues->received.commit();
+    if(d->queues->receivedSignalled.testAndSetOrdered(0, 1)) emit received();
+}
+
+void ARNetworkTransport::onVideoData(const ARControlFrame &frame)
+{
+    TRACE
+    Q_D(ARNetworkTransport);
+
+    if(frame.payloadSize < 5)
+    {
+        WARNING_T("Video frame too short for fragment header");
+        return;
+    }
+
+    quint16 frameNumber = qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(frame.payload));
+    quint8  frameFlags = static_cast<quint8>(frame.payload[2]);
+    quint8  fragmentNumber = static_cast<quint8>(frame.payload[3]);
+    quint8  fragsPerFrame = static_cast<quint8>(frame.payload[4]);
+
+    if(frameNumber != d->frameNumber)
+    {
+        if(frameFlags == 0x01)
+        {
+            DEBUG_T(QString("Video Key Frame Header [%1] (%2 %3 %4)")
+                    .arg(QString(QByteArray(frame.payload, 5).toHex()))
+                    .arg(frameNumber)
+                    .arg(fragmentNumber)
+                    .arg(fragsPerFrame));
+        }
+        else
+        {
+            DEBUG_T(QString("Video Frame Header (%2 %3 %4)")
+                    .arg(frameNumber)
+                    .arg(fragmentNumber)
+                    .arg(fragsPerFrame));
+        }
+
+        if(fragsPerFrame < 64)
+        {
+            d->hiAck = 0xffffffffffffffff;
+            d->loAck = 0xffffffffffffffff << fragsPerFrame;
+        }
+        else if(fragsPerFrame < 128)
+        {
+            d->hiAck = 0xffffffffffffffff << (fragsPerFrame - 64);
+            d->loAck = 0ll;
+        }
+        else
+        {
+            d->hiAck = 0ll;
+            d->loAck = 0ll;
+        }
+
+        d->frameNumber = frameNumber;
+    }
+
+    if(fragmentNumber < 64)
+    {
+        d->loAck |= (1ll << fragmentNumber);
+    }
+    else if(fragmentNumber < 128)
+    {
+        d->hiAck |= (1ll << (fragmentNumber - 64));
+    }
+
+    // Construct reply.
+    uchar payload[2 + 8 + 8];
+    qToLittleEndian<quint16>(frameNumber, payload);
+    qToLittleEndian<quint64>(d->hiAck, payload + 2);
+    qToLittleEndian<quint64>(d->loAck, payload + 10);
+
+    sendFrame(ARControlConnection::LowLatencyData, ARNET_C2D_VIDEO_ACK_ID, reinterpret_cast<const char*>(payload), sizeof(payload));
+}
@@ -0,0 +1,189 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARNETWORKTRANSPORT_H
+#define ARNETWORKTRANSPORT_H
+
+#include "config.h"
+#include "arspscqueue.h"
+
+#include <QObject>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QVariantMap>
+#include <QSharedPointer>
+
+class ARCommandDictionary;
+class ARCommandInfo;
+struct ARControlFrame;
+
+// A command received from the device, copied into a receive queue slot.
+struct ARReceivedCommand
+{
+    ARCommandInfo *command;
+
+    qint64  timestamp; // Nanoseconds since the transport was created.
+    quint32 datagram;  // Counter of the datagram the command arrived in.
+
+    int  size;
+    char payload[ARNETWORK_MAX_DATAGRAM_SIZE];
+};
+
+// A complete datagram waiting to be sent.
+struct AROutgoingDatagram
+{
+    qint64 queuedAt; // ARTransportQueues::clock, for time-to-wire.
+
+    int  size;
+    char data[ARNETWORK_MAX_DATAGRAM_SIZE];
+};
+
+// Latest piloting values, written by ARPiloting and sampled by the transport
+// on every piloting tick. Roll, pitch, yaw, gaz and the flag share a word, one
+// signed byte each in that order, so they're always sampled together.
+struct ARPilotingState
+{
+    QAtomicInteger<quint64> values;
+};
+
+// Hand-off between the connection, on the GUI thread, and the transport on
+// its network thread. Each queue has one producer and one consumer, the flags
+// make sure the consumer is only woken once per drain. Emergency datagrams
+// have a queue of their own, which the transport checks before every send.
+struct ARTransportQueues
+{
+    ARTransportQueues()
+        : received(ARNETWORK_RECEIVE_QUEUE_SIZE),
+          outgoing(ARNETWORK_SEND_QUEUE_SIZE),
+          emergency(ARNETWORK_EMERGENCY_QUEUE_SIZE)
+    {
+        clock.start();
+    }
+
+    ARSpscQueue<ARReceivedCommand>  received;
+    ARSpscQueue<AROutgoingDatagram> outgoing;
+    ARSpscQueue<AROutgoingDatagram> emergency;
+
+    // Shared by both threads, only read once started.
+    QElapsedTimer clock;
+
+    QAtomicInt receivedSignalled;
+    QAtomicInt outgoingSignalled;
+
+    ARPilotingState piloting;
+};
+
+// The device link: both UDP sockets, ping replies, acknowledges and video
+// acknowledges, and filtering of received commands. Runs on a thread of its
+// own so link timing doesn't depend on how busy the GUI thread is.
+class ARNetworkTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    ARNetworkTransport(const QSharedPointer<ARCommandDictionary> &dictionary, ARTransportQueues *queues);
+    ~ARNetworkTransport();
+
+public Q_SLOTS:
+    void open(const QString &localAddress, quint16 localPort, const QString &deviceAddress, quint16 devicePort);
+    void close();
+
+    // Sends everything in the emergency and outgoing queues, in that order.
+    void flush();
+
+    // Snapshots of ARController's per-command bitmaps. Without filtering
+    // every recognised command is queued, as batching needs them all.
+    void setInterest(const QBitArray &interest, const QBitArray &everySample);
+    void setFiltering(bool enabled);
+
+    // Send the given piloting command every interval milliseconds, with the
+    // values in the piloting state at the time.
+    void startPiloting(int project, int klass, int command, int interval);
+    void stopPiloting();
+
+    // Scheduling of the thread the transport runs on.
+    void setRealtime(bool enabled);
+    void setCpuAffinity(int cpu);
+
+Q_SIGNALS:
+    // Commands were added to the receive queue.
+    void received();
+
+    // A frame sent on an acknowledged buffer was acknowledged, or its
+    // retries ran out.
+    void delivered(int project, int klass, int command);
+    void deliveryFailed(int project, int klass, int command);
+
+    // An emergency datagram was written to the socket, latency is the time
+    // since it was queued in nanoseconds.
+    void emergencySent(qint64 latency);
+
+    // Link statistics, every ARNETWORK_LINK_INTERVAL_MS. Times are in
+    // milliseconds, RTT and jitter are -1 and the clock offset 0 until
+    // measured. Loss rates are the fraction of frames missing from each
+    // receive buffer's sequence over the interval, keyed by buffer id, and
+    // overall.
+    void linkQuality(double rtt, double jitter, double clockOffset, double loss, const QVariantMap &lossRates);
+
+    void error(const QString &message);
+
+protected Q_SLOTS:
+    void onReadyRead();
+    void onRetransmitTimeout();
+    void onPilotingTimeout();
+    void onLinkTimeout();
+    void onProjectLoaded();
+
+protected:
+    void processDatagram(const char *data, int size);
+
+    // Writes out anything in the emergency queue straight away.
+    void sendEmergency();
+
+    bool sendDatagram(const char *data, int size);
+    bool sendFrame(quint8 type, quint8 id, quint8 seq, const char *data, quint32 dataSize);
+    bool sendFrame(quint8 type, quint8 id, const char *data, quint32 dataSize);
+
+    // Writes the next sequence id of each frame's buffer into its header.
+    void stampSequenceIds(char *data, int size);
+
+    // Reliable delivery of acknowledged frames.
+    void trackReliable(const char *data, int size);
+    void scheduleRetransmit();
+    void onAcknowledge(const ARControlFrame &frame);
+
+    void onPing(const ARControlFrame &frame);
+    void onPong(const ARControlFrame &frame);
+    void onNavdata(const ARControlFrame &frame);
+
+    // Filters and queues a received command, header included. Commands of
+    // projects that aren't loaded yet are parked until they are.
+    void receiveCommand(quint8 bufferId, const char *data, int size, qint64 timestamp, quint32 datagram);
+    void onVideoData(const ARControlFrame &frame);
+
+    bool isInterested(const ARCommandInfo *command) const;
+    bool wantsEverySample(const ARCommandInfo *command) const;
+
+private:
+    class ARNetworkTransportPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(ARNetworkTransport)
+};
+
+#endif // ARNETWORKTRANSPORT_H
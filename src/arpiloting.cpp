@@ -0,0 +1,358 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include "arpiloting.h"
+
+#include "common.h"
+#include "config.h"
+
+#include "arcommandcodec.h"
+#include "arcommanddictionary.h"
+#include "arcontrolconnection.h"
+#include "arnetworktransport.h"
+
+struct ARPilotingPrivate
+{
+    ARPilotingPrivate(ARControlConnection *c, ARNetworkTransport *t, ARPilotingState *s, const QList<quint8> &p)
+        : connection(c), transport(t), state(s), projects(p), command(NULL),
+          active(false), loading(false), rate(ARPILOTING_DEFAULT_RATE),
+          flag(false), roll(0), pitch(0), yaw(0), gaz(0)
+    {/*...*/}
+
+    // Never loads projects, pending is set if some still have to be.
+    ARCommandInfo* resolve(bool *pending);
+
+    // Starts sending the piloting command at the current rate.
+    void start();
+
+    // Pre-encodes the emergency frames from the given project, if it's the
+    // device's and they aren't already.
+    void prepare(quint8 project);
+
+    ARControlConnection *connection;
+    ARNetworkTransport  *transport;
+    ARPilotingState     *state;
+
+    // Projects of the device, searched for its piloting command.
+    QList<quint8>  projects;
+    ARCommandInfo *command;
+
+    // Ready to send Piloting.Emergency and Piloting.Landing frames.
+    QByteArray emergencyFrame;
+    QByteArray landingFrame;
+
+    bool active;
+    bool loading; // Active, waiting for the device's projects to load.
+    int  rate;
+
+    bool flag;
+    int  roll;
+    int  pitch;
+    int  yaw;
+    int  gaz;
+};
+
+// The first of the device's projects with a Piloting.PCMD command.
+ARCommandInfo* ARPilotingPrivate::resolve(bool *pending)
+{
+    *pending = false;
+    if(command) return command;
+
+    ARCommandDictionary *dictionary = connection->dictionary();
+    QList<quint8> catalogued = dictionary->projects();
+
+    foreach(quint8 project, projects)
+    {
+        if(!dictionary->isLoaded(project))
+        {
+            if(catalogued.contains(project)) *pending = true;
+            continue;
+        }
+
+        command = dictionary->find(project, "Piloting", "PCMD");
+        if(command) break;
+    }
+
+    return command;
+}
+
+void ARPilotingPrivate::start()
+{
+    QMetaObject::invokeMethod(transport, "startPiloting", Qt::QueuedConnection,
+                              Q_ARG(int, command->klass->project),
+                              Q_ARG(int, command->klass->id),
+                              Q_ARG(int, command->id),
+                              Q_ARG(int, 1000 / rate));
+}
+
+void ARPilotingPrivate::prepare(quint8 project)
+{
+    if(!emergencyFrame.isEmpty() || !projects.contains(project)) return;
+
+    ARCommandDictionary *dictionary = connection->dictionary();
+    ARCommandInfo *emergency = dictionary->find(project, "Piloting", "Emergency");
+    ARCommandInfo *landing = dictionary->find(project, "Piloting", "Landing");
+    if(emergency == NULL || landing == NULL) return;
+
+    connection->codec()->encodeFrame(emergencyFrame, ARControlConnection::frameType(emergency->bufferId),
+                                     0x00, emergency, QVariantMap());
+    connection->codec()->encodeFrame(landingFrame, ARControlConnection::frameType(landing->bufferId),
+                                     0x00, landing, QVariantMap());
+}
+
+ARPiloting::ARPiloting(ARControlConnection *connection, ARNetworkTransport *transport,
+                       ARPilotingState *state, const QList<quint8> &projects)
+    : QObject(connection), d_ptr(new ARPilotingPrivate(connection, transport, state, projects))
+{
+    TRACE
+    Q_D(ARPiloting);
+
+    // Projects are loaded in the background, the frames are encoded as soon
+    // as the device's are in.
+    QObject::connect(connection->dictionary(), SIGNAL(projectLoaded(quint8)),
+                     this, SLOT(onProjectLoaded(quint8)));
+
+    foreach(quint8 project, projects)
+    {
+        if(connection->dictionary()->isLoaded(project)) d->prepare(project);
+    }
+}
+
+ARPiloting::~ARPiloting()
+{
+    TRACE
+    delete d_ptr;
+}
+
+bool ARPiloting::active() const
+{
+    Q_D(const ARPiloting);
+    return d->active;
+}
+
+void ARPiloting::setActive(bool active)
+{
+    Q_D(ARPiloting);
+    if(d->active == active) return;
+
+    if(active)
+    {
+        // Projects are loaded in the background, piloting starts from
+        // onProjectLoaded() once the one with the command is in.
+        bool pending = false;
+        if(d->resolve(&pending))
+        {
+            d->start();
+        }
+        else if(pending)
+        {
+            d->loading = true;
+            d->connection->dictionary()->loadProjectsAsync(d->projects);
+        }
+        else
+        {
+            WARNING_T("Device has no piloting command");
+            return;
+        }
+    }
+    else
+    {
+        d->loading = false;
+        QMetaObject::invokeMethod(d->transport, "stopPiloting", Qt::QueuedConnection);
+    }
+
+    d->active = active;
+    emit activeChanged();
+}
+
+int ARPiloting::rate() const
+{
+    Q_D(const ARPiloting);
+    return d->rate;
+}
+
+void ARPiloting::setRate(int rate)
+{
+    Q_D(ARPiloting);
+
+    rate = qBound(1, rate, 1000);
+    if(d->rate == rate) return;
+
+    d->rate = rate;
+
+    // Restarts the timer at the new interval.
+    if(d->active && !d->loading) d->start();
+
+    emit rateChanged();
+}
+
+bool ARPiloting::flag() const
+{
+    Q_D(const ARPiloting);
+    return d->flag;
+}
+
+void ARPiloting::setFlag(bool flag)
+{
+    Q_D(ARPiloting);
+    if(d->flag == flag) return;
+
+    d->flag = flag;
+    publish();
+}
+
+int ARPiloting::roll() const
+{
+    Q_D(const ARPiloting);
+    return d->roll;
+}
+
+void ARPiloting::setRoll(int roll)
+{
+    Q_D(const ARPiloting);
+    setValues(roll, d->pitch, d->yaw, d->gaz);
+}
+
+int ARPiloting::pitch() const
+{
+    Q_D(const ARPiloting);
+    return d->pitch;
+}
+
+void ARPiloting::setPitch(int pitch)
+{
+    Q_D(const ARPiloting);
+    setValues(d->roll, pitch, d->yaw, d->gaz);
+}
+
+int ARPiloting::yaw() const
+{
+    Q_D(const ARPiloting);
+    return d->yaw;
+}
+
+void ARPiloting::setYaw(int yaw)
+{
+    Q_D(const ARPiloting);
+    setValues(d->roll, d->pitch, yaw, d->gaz);
+}
+
+int ARPiloting::gaz() const
+{
+    Q_D(const ARPiloting);
+    return d->gaz;
+}
+
+void ARPiloting::setGaz(int gaz)
+{
+    Q_D(const ARPiloting);
+    setValues(d->roll, d->pitch, d->yaw, gaz);
+}
+
+void ARPiloting::setValues(int roll, int pitch, int yaw, int gaz)
+{
+    Q_D(ARPiloting);
+
+    roll = qBound(-100, roll, 100);
+    pitch = qBound(-100, pitch, 100);
+    yaw = qBound(-100, yaw, 100);
+    gaz = qBound(-100, gaz, 100);
+
+    if(d->roll == roll && d->pitch == pitch && d->yaw == yaw && d->gaz == gaz) return;
+
+    d->roll = roll;
+    d->pitch = pitch;
+    d->yaw = yaw;
+    d->gaz = gaz;
+    publish();
+}
+
+void ARPiloting::reset()
+{
+    Q_D(ARPiloting);
+    d->flag = false;
+    d->roll = d->pitch = d->yaw = d->gaz = 0;
+    publish();
+}
+
+bool ARPiloting::emergency()
+{
+    Q_D(ARPiloting);
+
+    if(d->emergencyFrame.isEmpty())
+    {
+        WARNING_T("Device has no emergency command");
+        return false;
+    }
+
+    return d->connection->sendEncodedFrame(d->emergencyFrame, true);
+}
+
+bool ARPiloting::land()
+{
+    Q_D(ARPiloting);
+
+    if(d->landingFrame.isEmpty())
+    {
+        WARNING_T("Device has no landing command");
+        return false;
+    }
+
+    return d->connection->sendEncodedFrame(d->landingFrame, true);
+}
+
+void ARPiloting::onProjectLoaded(quint8 project)
+{
+    Q_D(ARPiloting);
+    d->prepare(project);
+
+    if(!d->loading) return;
+
+    bool pending = false;
+    if(d->resolve(&pending))
+    {
+        d->loading = false;
+        d->start();
+    }
+    else if(!pending)
+    {
+        WARNING_T("Device has no piloting command");
+        d->loading = false;
+        d->active = false;
+        emit activeChanged();
+    }
+}
+
+// Only the latest values matter, each write replaces the last whether or not
+// it was sent.
+void ARPiloting::publish()
+{
+    Q_D(ARPiloting);
+
+    quint64 values = quint64(quint8(d->roll))
+                   | quint64(quint8(d->pitch)) << 8
+                   | quint64(quint8(d->yaw)) << 16
+                   | quint64(quint8(d->gaz)) << 24
+                   | quint64(d->flag ? 1 : 0) << 32;
+
+    d->state->values.storeRelease(values);
+
+    emit valuesChanged();
+}
@@ -0,0 +1,107 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARPILOTING_H
+#define ARPILOTING_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+
+class ARControlConnection;
+class ARNetworkTransport;
+struct ARPilotingState;
+
+// Fixed rate piloting. While active, the device's piloting command is sent
+// from the network thread at the given rate with whatever values were set
+// last, so GUI load neither delays sends nor piles them up. Values are
+// percentages, -100 to 100. Ground vehicles, such as the Jumping Sumo, take
+// pitch as their speed and yaw as their turn.
+//
+// Emergency and landing commands are encoded as soon as the device's project
+// is loaded, and sent ahead of anything else queued.
+class ARPiloting : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(int rate READ rate WRITE setRate NOTIFY rateChanged)
+
+    Q_PROPERTY(bool flag READ flag WRITE setFlag NOTIFY valuesChanged)
+    Q_PROPERTY(int roll READ roll WRITE setRoll NOTIFY valuesChanged)
+    Q_PROPERTY(int pitch READ pitch WRITE setPitch NOTIFY valuesChanged)
+    Q_PROPERTY(int yaw READ yaw WRITE setYaw NOTIFY valuesChanged)
+    Q_PROPERTY(int gaz READ gaz WRITE setGaz NOTIFY valuesChanged)
+
+public:
+    ARPiloting(ARControlConnection *connection, ARNetworkTransport *transport,
+               ARPilotingState *state, const QList<quint8> &projects);
+   ~ARPiloting();
+
+    bool active() const;
+    void setActive(bool active);
+
+    // Sends per second.
+    int  rate() const;
+    void setRate(int rate);
+
+    // Whether roll and pitch are applied.
+    bool flag() const;
+    void setFlag(bool flag);
+
+    int  roll() const;
+    void setRoll(int roll);
+    int  pitch() const;
+    void setPitch(int pitch);
+    int  yaw() const;
+    void setYaw(int yaw);
+    int  gaz() const;
+    void setGaz(int gaz);
+
+    // Set every axis at once, they're sent together.
+    Q_INVOKABLE void setValues(int roll, int pitch, int yaw, int gaz);
+
+public Q_SLOTS:
+    // Zero every value, hovering in place.
+    void reset();
+
+    // Cut the motors straight away.
+    bool emergency();
+
+    // Land, sent with the same priority as emergency().
+    bool land();
+
+Q_SIGNALS:
+    void activeChanged();
+    void rateChanged();
+    void valuesChanged();
+
+protected Q_SLOTS:
+    void onProjectLoaded(quint8 project);
+
+protected:
+    void publish();
+
+private:
+    class ARPilotingPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(ARPiloting)
+};
+
+#endif // ARPILOTING_H
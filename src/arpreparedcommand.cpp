@@ -0,0 +1,158 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#include "arpreparedcommand.h"
+
+#include "common.h"
+#include "config.h"
+
+#include "arcommandcodec.h"
+#include "arcommanddictionary.h"
+#include "arcontrolconnection.h"
+
+#include <QPointer>
+
+struct ARPreparedCommandPrivate
+{
+    ARPreparedCommandPrivate(ARControlConnection *c, ARCommandInfo *i)
+        : connection(c), command(i), fixedLayout(true), dirty(false)
+    {/*...*/}
+
+    QPointer<ARControlConnection> connection;
+    ARCommandInfo                *command;
+
+    // Frame header, command header and arguments, ready to send.
+    QByteArray frame;
+
+    // Without string arguments every slot has a fixed offset and is patched
+    // in place, otherwise arguments are kept and the frame re-encoded.
+    bool        fixedLayout;
+    bool        dirty;
+    QVariantMap params;
+};
+
+ARPreparedCommand::ARPreparedCommand(ARControlConnection *connection, ARCommandInfo *command, QObject *parent)
+    : QObject(parent), d_ptr(new ARPreparedCommandPrivate(connection, command))
+{
+    TRACE
+    Q_D(ARPreparedCommand);
+
+    for(int i = 0; i < command->arguments.size(); i++)
+    {
+        if(command->arguments.at(i)->size == 0) d->fixedLayout = false;
+    }
+
+    d->frame.reserve(ARNETWORK_MAX_DATAGRAM_SIZE);
+    connection->codec()->encodeFrame(d->frame, ARControlConnection::frameType(command->bufferId), 0x00, command, QVariantMap());
+}
+
+ARPreparedCommand::~ARPreparedCommand()
+{
+    TRACE
+    delete d_ptr;
+}
+
+ARCommandInfo* ARPreparedCommand::command() const
+{
+    Q_D(const ARPreparedCommand);
+    return d->command;
+}
+
+QString ARPreparedCommand::name() const
+{
+    Q_D(const ARPreparedCommand);
+    return *d->command->name;
+}
+
+bool ARPreparedCommand::setArgument(int index, const QVariant &value)
+{
+    Q_D(ARPreparedCommand);
+
+    if(index < 0 || index >= d->command->arguments.size())
+    {
+        WARNING_T(QString("No argument %1 in %2").arg(index).arg(*d->command->name));
+        return false;
+    }
+
+    const ARCommandArgumentInfo *argument = d->command->arguments.at(index);
+
+    if(!d->fixedLayout)
+    {
+        d->params.insert(*argument->name, value);
+        d->dirty = true;
+        return true;
+    }
+
+    char *slot = d->frame.data()
+               + ARNETWORK_FRAME_HEADER_SIZE
+               + ARNETWORK_COMMAND_HEADER_SIZE
+               + argument->offset;
+
+    return ARCommandCodec::writeArgument(slot, argument, value);
+}
+
+bool ARPreparedCommand::setArgument(const QString &name, const QVariant &value)
+{
+    Q_D(ARPreparedCommand);
+
+    for(int i = 0; i < d->command->arguments.size(); i++)
+    {
+        if(*d->command->arguments.at(i)->name == name) return setArgument(i, value);
+    }
+
+    WARNING_T(QString("No argument %1 in %2").arg(name).arg(*d->command->name));
+    return false;
+}
+
+bool ARPreparedCommand::setArguments(const QVariantMap &params)
+{
+    bool result = true;
+
+    for(QVariantMap::const_iterator it = params.constBegin(); it != params.constEnd(); ++it)
+    {
+        result &= setArgument(it.key(), it.value());
+    }
+
+    return result;
+}
+
+const QByteArray& ARPreparedCommand::frame()
+{
+    Q_D(ARPreparedCommand);
+
+    if(d->dirty && d->connection)
+    {
+        d->frame.resize(0);
+        d->connection->codec()->encodeFrame(d->frame, ARControlConnection::frameType(d->command->bufferId), 0x00, d->command, d->params);
+        d->dirty = false;
+    }
+
+    return d->frame;
+}
+
+bool ARPreparedCommand::send()
+{
+    Q_D(ARPreparedCommand);
+
+    if(!d->connection) return false;
+
+    frame();
+    return d->connection->sendEncodedFrame(d->frame);
+}
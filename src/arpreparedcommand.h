@@ -0,0 +1,62 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARPREPAREDCOMMAND_H
+#define ARPREPAREDCOMMAND_H
+
+#include <QObject>
+#include <QVariantMap>
+
+class ARControlConnection;
+class ARCommandInfo;
+
+// A command resolved once, with its frame pre-encoded. Setting arguments
+// patches their slot in the frame, send() then only queues the frame.
+// Commands with string arguments are re-encoded on send. Sending fails once
+// the connection is gone.
+class ARPreparedCommand : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QString name READ name CONSTANT)
+
+public:
+    ARPreparedCommand(ARControlConnection *connection, ARCommandInfo *command, QObject *parent = 0);
+   ~ARPreparedCommand();
+
+    ARCommandInfo* command() const;
+    QString name() const;
+
+    Q_INVOKABLE bool setArgument(int index, const QVariant &value);
+    Q_INVOKABLE bool setArgument(const QString &name, const QVariant &value);
+    Q_INVOKABLE bool setArguments(const QVariantMap &params);
+
+    // The encoded frame, as sent by the next send().
+    const QByteArray& frame();
+
+public Q_SLOTS:
+    bool send();
+
+private:
+    class ARPreparedCommandPrivate *d_ptr;
+    Q_DECLARE_PRIVATE(ARPreparedCommand)
+};
+
+#endif // ARPREPAREDCOMMAND_H
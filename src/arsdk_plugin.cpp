@@ -26,6 +26,8 @@
 #include "arcontrolconnection.h"
 #include "arcommandlistener.h"
 #include "ardiscoverydevice.h"
+#include "arpiloting.h"
+#include "arpreparedcommand.h"
 
 void ARSDKPlugin::registerTypes(const char *uri)
 {
@@ -34,4 +36,6 @@ void ARSDKPlugin::registerTypes(const char *uri)
     qmlRegisterUncreatableType<ARControlConnection>(uri, 1, 0, "ARControlConnection", "Uncreatable type");
     qmlRegisterType<ARCommandListener>(uri, 1, 0, "ARCommandListener");
     qmlRegisterType<ARDiscoveryDevice>(uri, 1, 0, "ARDiscoveryDevice");
+    qmlRegisterUncreatableType<ARPreparedCommand>(uri, 1, 0, "ARPreparedCommand", "Uncreatable type");
+    qmlRegisterUncreatableType<ARPiloting>(uri, 1, 0, "ARPiloting", "Uncreatable type");
 }
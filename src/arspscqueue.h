@@ -0,0 +1,90 @@
+/*
+    The file is part of the qt-arsdk project.
+
+    Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+#ifndef ARSPSCQUEUE_H
+#define ARSPSCQUEUE_H
+
+#include <QAtomicInteger>
+#include <QVector>
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+// Entries are written and read in place: the producer fills slots with
+// push(), and makes them visible to the consumer with commit(). The consumer
+// reads front() and releases it with pop(). Capacity is rounded up to a power
+// of two, and slots are never reallocated.
+template<typename T>
+class ARSpscQueue
+{
+public:
+    explicit ARSpscQueue(int capacity)
+        : m_head(0), m_tail(0), m_pending(0)
+    {
+        int size = 1;
+        while(size < capacity) size <<= 1;
+
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    int capacity() const { return m_slots.size(); }
+
+    // Producer. Returns the next free slot, or NULL if the queue is full.
+    T* push()
+    {
+        if(m_pending - m_head.loadAcquire() >= quint32(capacity())) return NULL;
+        return &m_slots[m_pending++ & m_mask];
+    }
+
+    // Producer. Publishes every slot pushed since the last commit.
+    void commit()
+    {
+        m_tail.storeRelease(m_pending);
+    }
+
+    // Consumer. The oldest published slot, or NULL if there is none.
+    T* front()
+    {
+        quint32 head = m_head.load();
+        if(head == m_tail.loadAcquire()) return NULL;
+        return &m_slots[head & m_mask];
+    }
+
+    // Consumer. Releases the slot returned by front().
+    void pop()
+    {
+        m_head.storeRelease(m_head.load() + 1);
+    }
+
+private:
+    QVector<T> m_slots;
+    quint32    m_mask;
+
+    // Written by the consumer, and by the producer respectively. Kept on
+    // separate cache lines so the two threads don't contend for them.
+    // Counters wrap, only their difference matters.
+    QAtomicInteger<quint32> m_head;
+    char                    m_padHead[64 - sizeof(QAtomicInteger<quint32>)];
+    QAtomicInteger<quint32> m_tail;
+    char                    m_padTail[64 - sizeof(QAtomicInteger<quint32>)];
+
+    quint32 m_pending; // Producer only.
+};
+
+#endif // ARSPSCQUEUE_H
@@ -30,8 +30,34 @@
 
 #define ARNETWORK_FRAME_HEADER_SIZE 7
 #define ARNETWORK_COMMAND_HEADER_SIZE 4
+#define ARNETWORK_MAX_DATAGRAM_SIZE 1500
+#define ARNETWORK_RECEIVE_QUEUE_SIZE 256
+#define ARNETWORK_SEND_QUEUE_SIZE 64
+#define ARNETWORK_EMERGENCY_QUEUE_SIZE 8
+#define ARNETWORK_REALTIME_PRIORITY 10
+#define ARNETWORK_BATCH_SIZE 32
+#define ARNETWORK_RELIABLE_WINDOW 32
+#define ARNETWORK_RELIABLE_RETRIES 5
+#define ARNETWORK_INITIAL_RTO_MS 150
+#define ARNETWORK_MIN_RTO_MS 20
+#define ARNETWORK_MAX_RTO_MS 2000
+#define ARNETWORK_SEQUENCE_WINDOW 10
+#define ARNETWORK_LINK_INTERVAL_MS 500
+#define ARNETWORK_MAX_PARKED_FRAMES 64
+
+#define ARPILOTING_DEFAULT_RATE 40
+
+#define ARCOMMANDS_PROJECT_COMMON       0
+#define ARCOMMANDS_PROJECT_ARDRONE3     1
+#define ARCOMMANDS_PROJECT_MINIDRONE    2
+#define ARCOMMANDS_PROJECT_JUMPINGSUMO  3
+#define ARCOMMANDS_PROJECT_SKYCONTROLLER 4
+
+#define ARCOMMANDS_DEFAULT_PROJECT ARCOMMANDS_PROJECT_ARDRONE3
 
 #define ARNET_D2C_PING_ID       0x00
+#define ARNET_C2D_PING_ID       0x00
+#define ARNET_D2C_PONG_ID       0x01
 #define ARNET_C2D_PONG_ID       0x01
 #define ARNET_C2D_NONACK_ID     0x0a
 #define ARNET_C2D_ACK_ID        0x0b
@@ -42,4 +68,7 @@
 #define ARNET_D2C_VIDEO_DATA_ID 0x7d
 #define ARNET_C2D_NAVDATA_ACK_ID 0xfe
 
+// Acknowledges of a buffer are sent on the buffer's id plus this offset.
+#define ARNET_ACK_ID_OFFSET     0x80
+
 #endif // CONFIG
@@ -0,0 +1,254 @@
+#!/usr/bin/env python
+#
+#   The file is part of the qt-arsdk project.
+#
+#   Copyright (C) 2015-2016 Tom Swindell <t.swindell@rubyx.co.uk>
+#
+#   This library is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU Lesser General Public
+#   License as published by the Free Software Foundation; either
+#   version 2.1 of the License, or (at your option) any later version.
+#
+#   This library is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#   Lesser General Public License for more details.
+#
+#   You should have received a copy of the GNU Lesser General Public
+#   License along with this library; if not, write to the Free Software
+#   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+#
+"""
+Generates typed C++ command structs and a static command table from a
+libARCommands XML project file.
+
+Usage: arcommandsgen.py <input.xml> <output.h>
+"""
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+CPP_TYPES = {
+    'u8': 'quint8', 'i8': 'qint8',
+    'u16': 'quint16', 'i16': 'qint16',
+    'u32': 'quint32', 'i32': 'qint32',
+    'u64': 'quint64', 'i64': 'qint64',
+    'float': 'float', 'double': 'double',
+    'string': 'const char *',
+    'enum': 'qint32',
+}
+
+# Frame buffer a command is sent on, commands are acknowledged by default.
+BUFFER_IDS = {
+    'NON_ACK': 0x0a,
+    'ACK': 0x0b,
+    'HIGH_PRIO': 0x0c,
+}
+
+CPP_KEYWORDS = set("""
+    alignas alignof and and_eq asm auto bitand bitor bool break case catch
+    char char16_t char32_t class compl const constexpr const_cast continue
+    decltype default delete do double dynamic_cast else enum explicit export
+    extern false float for friend goto if inline int long mutable namespace
+    new noexcept not not_eq nullptr operator or or_eq private protected public
+    register reinterpret_cast return short signed sizeof static static_assert
+    static_cast struct switch template this thread_local throw true try
+    typedef typeid typename union unsigned using virtual void volatile
+    wchar_t while xor xor_eq signals slots emit foreach
+""".split())
+
+
+def identifier(name):
+    name = re.sub(r'[^A-Za-z0-9_]', '_', name)
+    if not name or name[0].isdigit() or name in CPP_KEYWORDS:
+        name = '_' + name
+    return name
+
+
+def cstring(value):
+    return '"%s"' % value.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def parse(path):
+    root = ET.parse(path).getroot()
+    if root.tag != 'project':
+        raise ValueError('%s: format not understood' % path)
+
+    project = {'name': root.get('name'), 'id': int(root.get('id')), 'classes': []}
+
+    for klass_el in root.findall('class'):
+        klass = {'name': klass_el.get('name'), 'id': int(klass_el.get('id')), 'commands': []}
+
+        # The command id is reflected by its position in the class definition.
+        for index, cmd_el in enumerate(klass_el.findall('cmd')):
+            command = {
+                'name': cmd_el.get('name'),
+                'id': index,
+                'buffer': BUFFER_IDS.get(cmd_el.get('buffer'), 0x0b),
+                'args': [],
+            }
+
+            for arg_el in cmd_el.findall('arg'):
+                argtype = arg_el.get('type')
+                if argtype not in CPP_TYPES:
+                    raise ValueError('%s: unhandled argument type %s' % (path, argtype))
+
+                command['args'].append({
+                    'name': arg_el.get('name'),
+                    'type': argtype,
+                    'enum': [e.get('name') for e in arg_el.findall('enum')],
+                })
+
+            klass['commands'].append(command)
+
+        project['classes'].append(klass)
+
+    return project
+
+
+def generate_struct(out, project, klass, command):
+    out.append('    struct %s' % identifier(command['name']))
+    out.append('    {')
+    out.append('        static constexpr quint8  projectId = %d;' % project['id'])
+    out.append('        static constexpr quint8  classId = %d;' % klass['id'])
+    out.append('        static constexpr quint16 commandId = %d;' % command['id'])
+    out.append('        static constexpr quint8  bufferId = 0x%02x;' % command['buffer'])
+    out.append('')
+
+    for arg in command['args']:
+        if arg['type'] == 'enum' and arg['enum']:
+            out.append('        enum %s_t {' % identifier(arg['name']))
+            out.append(',\n'.join('            %s_%s = %d' % (identifier(arg['name']), identifier(v), i)
+                                  for i, v in enumerate(arg['enum'])))
+            out.append('        };')
+            out.append('')
+
+    for arg in command['args']:
+        out.append('        %s %s;' % (CPP_TYPES[arg['type']], identifier(arg['name'])))
+
+    # Encoding, returns the number of bytes written or -1 if capacity is too small.
+    out.append('')
+    out.append('        int encode(char *dst, int capacity) const')
+    out.append('        {')
+    out.append('            ARCommandWriter w(dst, capacity);')
+    for arg in command['args']:
+        if arg['type'] == 'string':
+            out.append('            w.putString(%s);' % identifier(arg['name']))
+        else:
+            out.append('            w.put<%s>(%s);' % (CPP_TYPES[arg['type']], identifier(arg['name'])))
+    out.append('            return w.result();')
+    out.append('        }')
+
+    # Decoding, strings point into the payload.
+    out.append('')
+    out.append('        bool decode(const char *src, int size)')
+    out.append('        {')
+    out.append('            ARCommandReader r(src, size);')
+    for arg in command['args']:
+        if arg['type'] == 'string':
+            out.append('            %s = r.getString();' % identifier(arg['name']))
+        else:
+            out.append('            %s = r.get<%s>();' % (identifier(arg['name']), CPP_TYPES[arg['type']]))
+    out.append('            return r.ok();')
+    out.append('        }')
+    out.append('    };')
+    out.append('')
+
+
+def generate_table(out, project, table):
+    out.append('namespace Tables {')
+    out.append('')
+    out.append('inline const ARCommandTable& %s()' % table)
+    out.append('{')
+
+    for klass in project['classes']:
+        for command in klass['commands']:
+            prefix = '%s_%s' % (identifier(klass['name']), identifier(command['name']))
+            for arg in command['args']:
+                if arg['enum']:
+                    out.append('    static const char * const %s_%s_enum[] = { %s };'
+                               % (prefix, identifier(arg['name']), ', '.join(cstring(v) for v in arg['enum'])))
+            if command['args']:
+                out.append('    static const ARCommandTableArgument %s_args[] = {' % prefix)
+                for arg in command['args']:
+                    enum = '%s_%s_enum' % (prefix, identifier(arg['name'])) if arg['enum'] else '0'
+                    out.append('        { %s, %s, %s, %d },'
+                               % (cstring(arg['name']), cstring(arg['type']), enum, len(arg['enum'])))
+                out.append('    };')
+
+    out.append('    static const ARCommandTableCommand commands[] = {')
+    count = 0
+    for klass in project['classes']:
+        for command in klass['commands']:
+            prefix = '%s_%s' % (identifier(klass['name']), identifier(command['name']))
+            args = '%s_args' % prefix if command['args'] else '0'
+            out.append('        { %d, %s, %d, %s, 0x%02x, %s, %d },'
+                       % (klass['id'], cstring(klass['name']), command['id'], cstring(command['name']),
+                          command['buffer'], args, len(command['args'])))
+            count += 1
+    out.append('    };')
+    out.append('    static const ARCommandTable table = { %d, %s, commands, %d };'
+               % (project['id'], cstring(project['name']), count))
+    out.append('    return table;')
+    out.append('}')
+    out.append('')
+    out.append('} // namespace Tables')
+
+
+def generate(path, project):
+    base = os.path.splitext(os.path.basename(path))[0]
+    guard = 'ARCOMMANDS_%s_H' % identifier(base).upper()
+
+    out = []
+    out.append('// Generated by arcommandsgen.py from %s, do not edit.' % os.path.basename(path))
+    out.append('#ifndef %s' % guard)
+    out.append('#define %s' % guard)
+    out.append('')
+    out.append('#include "arcommandtable.h"')
+    out.append('')
+    out.append('namespace ARCommands {')
+    out.append('namespace %s {' % identifier(project['name']))
+    out.append('')
+
+    for klass in project['classes']:
+        out.append('namespace %s {' % identifier(klass['name']))
+        out.append('')
+        for command in klass['commands']:
+            generate_struct(out, project, klass, command)
+        out.append('} // namespace %s' % identifier(klass['name']))
+        out.append('')
+
+    out.append('} // namespace %s' % identifier(project['name']))
+    out.append('')
+    generate_table(out, project, identifier(base))
+    out.append('')
+    out.append('} // namespace ARCommands')
+    out.append('')
+    out.append('#endif // %s' % guard)
+    out.append('')
+
+    return '\n'.join(out)
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    source = generate(argv[1], parse(argv[1]))
+
+    # Don't touch the output if nothing changed, to avoid needless rebuilds.
+    if os.path.exists(argv[2]):
+        with open(argv[2]) as f:
+            if f.read() == source:
+                return 0
+
+    with open(argv[2], 'w') as f:
+        f.write(source)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))